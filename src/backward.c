@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "backward.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Words of memory in use.
+ */
+static inline size_t TMBackward_used(TMBackwardSearch* search){
+	return search->level[0].size + search->level[1].size + search->slots;
+}
+
+/*
+ * Hash of a configuration; its position on the tape does not count.
+ */
+uint64_t TMBackward_hash(uint64_t* node){
+	uint64_t hash = node[0] * 0x9e3779b97f4a7c15ull ^ (node[1] - node[2]) * 0xd6e8feb86659fd93ull;
+	for (uint64_t i = 0; i < node[3]; i++)
+		hash = (hash ^ node[TM_BACKWARD_HEADER + i]) * 0xbf58476d1ce4e5b9ull;
+	return hash ^ (hash >> 31);
+}
+
+/*
+ * Whether two configurations only differ by their position.
+ */
+bool TMBackward_equal(uint64_t* a, uint64_t* b){
+	return a[0] == b[0] && a[1] - a[2] == b[1] - b[2] && a[3] == b[3]
+		&& !memcmp(a + TM_BACKWARD_HEADER, b + TM_BACKWARD_HEADER, a[3] * sizeof(uint64_t));
+}
+
+/*
+ * Rebuild the index with the given count of slots.
+ */
+void TMBackward_reindex(TMBackwardSearch* search, size_t slots){
+	free(search->index);
+	search->slots = slots;
+	search->index = calloc(slots, sizeof(uint64_t));
+	assert(search->index);
+	TMBackwardLevel *level = &search->level[1];
+	for (size_t i = 0; i < level->used; i += TM_BACKWARD_HEADER + level->words[i + 3]){
+		size_t slot = TMBackward_hash(level->words + i) & (slots - 1);
+		while (search->index[slot])
+			slot = (slot + 1) & (slots - 1);
+		search->index[slot] = i + 1;
+	}
+}
+
+/*
+ * Add a configuration to the next level unless it is there already:
+ * the known cells of `node` with `sym` written at `head`, which may
+ * extend them by one. Return false if it does not fit the budget.
+ */
+bool TMBackward_push(TMBackwardSearch* search, uint64_t* node,
+					 uint64_t state, int64_t head, uint64_t sym){
+	TMBackwardLevel *level = &search->level[1];
+	int64_t lo = node[2], hi = lo + node[3] - 1;
+	lo = head < lo ? head : lo;
+	hi = head > hi ? head : hi;
+	size_t n = hi - lo + 1, need = level->used + TM_BACKWARD_HEADER + n;
+	if (need > level->size){
+		size_t size = level->size ? level->size : 1024;
+		while (size < need)
+			size *= 2;
+		if (TMBackward_used(search) - level->size + size > search->budget)
+			size = search->budget - (TMBackward_used(search) - level->size);
+		if (size < need)
+			return false;
+		level->words = realloc(level->words, size * sizeof(uint64_t));
+		assert(level->words);
+		level->size = size;
+	}
+	uint64_t *to = level->words + level->used;
+	to[0] = state;
+	to[1] = head;
+	to[2] = lo;
+	to[3] = n;
+	memcpy(to + TM_BACKWARD_HEADER + (node[2] - lo), node + TM_BACKWARD_HEADER,
+		   node[3] * sizeof(uint64_t));
+	to[TM_BACKWARD_HEADER + head - lo] = sym;
+
+	if (2 * (search->count + 1) > search->slots){
+		size_t slots = search->slots ? 2 * search->slots : 1024;
+		if (TMBackward_used(search) - search->slots + slots > search->budget)
+			return false;
+		TMBackward_reindex(search, slots);
+	}
+	size_t slot = TMBackward_hash(to) & (search->slots - 1);
+	for (; search->index[slot]; slot = (slot + 1) & (search->slots - 1))
+		if (TMBackward_equal(level->words + search->index[slot] - 1, to))
+			return true;
+	search->index[slot] = level->used + 1;
+	search->count++;
+	level->used = need;
+	return true;
+}
+
+/*
+ * Whether the tape is an instance of the partial configuration.
+ */
+bool TMBackward_initial(uint64_t* node, TMTape* tape){
+	if (node[0] != tape->state)
+		return false;
+	int64_t head = node[1], lo = node[2];
+	for (uint64_t i = 0; i < node[3]; i++)
+		if (TMTape_read_at(tape, tape->pos + lo + (int64_t)i - head) != node[TM_BACKWARD_HEADER + i])
+			return false;
+	return true;
+}
+
+/*
+ * Make the next level current and start an empty one.
+ */
+void TMBackward_advance(TMBackwardSearch* search){
+	TMBackwardLevel swap = search->level[0];
+	search->level[0] = search->level[1];
+	search->level[1] = swap;
+	search->level[1].used = 0;
+	search->count = 0;
+	memset(search->index, 0, search->slots * sizeof(uint64_t));
+}
+
+bool TMBackward_decide(TM* machine, TMTape* tape, uint64_t depth, size_t memory, TMBackward* result){
+	TMTape* blank = NULL;
+	if (!tape){
+		blank = tape = TMTape_init(TMTape_bits(machine->n), true);
+		TMTape_prepare(tape);
+	}
+	TMBackwardSearch search = { machine, { { 0 }, { 0 } }, NULL, 0, 0, memory / sizeof(uint64_t) };
+	TMBackwardLevel *cur = &search.level[0];
+	bool fits = true, proven = false;
+	*result = (TMBackward){ 0, 0 };
+
+	// Configurations right before halting: the head reading `a` in a running state `s`.
+	uint64_t root[TM_BACKWARD_HEADER + 1] = { 0, 0, 0, 1, 0 };
+	for (uint64_t s = 1; fits && s <= machine->q; s++)
+		for (uint64_t a = 0; fits && a < machine->n; a++)
+			if (!machine->ok[s - 1] && !(TM_entry(machine, s, a) & TM_GO)){
+				fits = TMBackward_push(&search, root, s, 0, a);
+				result->nodes++;
+			}
+	if (fits)
+		TMBackward_advance(&search);
+
+	while (fits && tape->state && !machine->ok[tape->state - 1]){
+		if (!cur->used){
+			proven = true;
+			break;
+		}
+		bool reachable = false;
+		for (size_t i = 0; !reachable && i < cur->used; i += TM_BACKWARD_HEADER + cur->words[i + 3])
+			reachable = TMBackward_initial(cur->words + i, tape);
+		if (reachable || result->depth == depth)
+			break;
+
+		// Steps leading to each configuration: S' a' -> S w, with `w` where the head was.
+		for (size_t i = 0; fits && i < cur->used; i += TM_BACKWARD_HEADER + cur->words[i + 3]){
+			uint64_t *node = cur->words + i, *cells = node + TM_BACKWARD_HEADER;
+			int64_t head = node[1], lo = node[2];
+			for (uint64_t s = 1; fits && s <= machine->q; s++){
+				if (machine->ok[s - 1])
+					continue;
+				for (uint64_t a = 0; fits && a < machine->n; a++){
+					uint64_t e = TM_entry(machine, s, a);
+					if (!(e & TM_GO) || TM_entry_state(machine, e) != node[0])
+						continue;
+					int64_t prev = head + (TM_entry_motion(e) ? -1 : 1);
+					if (prev >= lo && prev < lo + (int64_t)node[3]
+						&& cells[prev - lo] != TM_entry_symbol(machine, e))
+						continue;
+					fits = TMBackward_push(&search, node, s, prev, a);
+					result->nodes++;
+				}
+			}
+		}
+		if (fits)
+			TMBackward_advance(&search);
+		result->depth++;
+	}
+
+	free(search.level[0].words);
+	free(search.level[1].words);
+	free(search.index);
+	if (blank)
+		TMTape_free(blank);
+	return proven;
+}
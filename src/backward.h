@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "core.h"
+
+/*
+ * Default depth of the search (in steps back from halting).
+ */
+#define TM_BACKWARD_DEPTH 32
+/*
+ * Default memory budget of the search (in bytes).
+ */
+#define TM_BACKWARD_MEMORY (64 << 20)
+
+/*
+ * A partial configuration is stored as words of a level:
+ * the state, the head position, the leftmost known cell
+ * and the count of known cells, then the known cells
+ * (which are contiguous and include the head).
+ */
+#define TM_BACKWARD_HEADER 4
+
+/*
+ * Partial configurations at a given count of steps back.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t used, size;  // in words
+} TMBackwardLevel;
+
+/*
+ * Breadth-first search state: configurations `level[0]` steps back
+ * lead to those of `level[1]`, duplicates of which are found with
+ * an open-addressing index (offsets of configurations plus one).
+ * Levels and the index share a budget (in words).
+ */
+typedef struct {
+	TM *machine;
+	TMBackwardLevel level[2];
+	uint64_t *index;
+	size_t slots, count;
+	size_t budget;
+} TMBackwardSearch;
+
+/*
+ * Search outcome: the machine cannot halt if every branch
+ * of the search died out within `depth` steps back.
+ */
+typedef struct {
+	uint64_t depth,  // levels searched
+			 nodes;  // partial configurations visited
+} TMBackward;
+
+/*
+ * Try to prove that the machine cannot halt from the given tape
+ * (or a blank tape in state 1 if NULL) by searching back from
+ * its halting transitions (undefined ones and those into final
+ * states) for at most `depth` steps, keeping at most `memory`
+ * bytes of partial configurations. Return true if none of them
+ * is reachable from the tape, filling `result` either way.
+ */
+bool TMBackward_decide(TM*, TMTape*, uint64_t depth, size_t memory, TMBackward* result);
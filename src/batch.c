@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "batch.h"
+#include "interpreter.h"
+#include "tmc.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+TMBatch* TMBatch_init(uint64_t max, double limit, bool json, unsigned threads, FILE* out){
+	assert(threads);
+	TMBatch* b = NEWSTR(TMBatch);
+	assert(b);
+	b->size = 16;
+	b->n = 0;
+	b->paths = NEWARR(char*, b->size);
+	assert(b->paths);
+	b->max = max;
+	b->limit = limit;
+	b->json = json;
+	b->threads = threads;
+	atomic_init(&b->next, 0);
+	b->out = out;
+	pthread_mutex_init(&b->lock, NULL);
+	b->errors = 0;
+	b->cache = false;
+	return b;
+}
+
+void TMBatch_free(TMBatch* b){
+	for (size_t i = 0; i < b->n; i++)
+		free(b->paths[i]);
+	free(b->paths);
+	pthread_mutex_destroy(&b->lock);
+	free(b);
+}
+
+/*
+ * Append a copy of the path of a machine file.
+ */
+void TMBatch_push(TMBatch* b, char *path){
+	if (b->n == b->size){
+		b->size *= 2;
+		b->paths = realloc(b->paths, b->size * sizeof(char*));
+		assert(b->paths);
+	}
+	b->paths[b->n] = NEWARR(char, strlen(path) + 1);
+	assert(b->paths[b->n]);
+	strcpy(b->paths[b->n++], path);
+}
+
+/*
+ * Machine files of a directory.
+ */
+int TMBatch_filter(const struct dirent *entry){
+	size_t len = strlen(entry->d_name);
+	return len > 4 && strcmp(entry->d_name + len - 4, ".dtm") == 0;
+}
+
+bool TMBatch_add(TMBatch* b, char *path){
+	if (strcmp(path, "-") == 0){
+		while (!feof(stdin)){
+			char *line = readline_trim(stdin);
+			if (strlen(line))
+				TMBatch_push(b, line);
+			free(line);
+		}
+		return true;
+	}
+	struct stat st;
+	if (stat(path, &st)){
+		fprintf(stderr, "Could not open %s.\n", path);
+		return false;
+	}
+	if (!S_ISDIR(st.st_mode)){
+		TMBatch_push(b, path);
+		return true;
+	}
+	struct dirent **entries;
+	int n = scandir(path, &entries, TMBatch_filter, alphasort);
+	if (n < 0){
+		fprintf(stderr, "Could not read %s.\n", path);
+		return false;
+	}
+	char *file = NULL;
+	for (int i = 0; i < n; i++){
+		file = realloc(file, strlen(path) + strlen(entries[i]->d_name) + 2);
+		assert(file);
+		sprintf(file, "%s/%s", path, entries[i]->d_name);
+		TMBatch_push(b, file);
+		free(entries[i]);
+	}
+	free(file);
+	free(entries);
+	return true;
+}
+
+double TMBatch_clock(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * Write a CSV field, quoted if needed.
+ */
+void TMBatch_csv(FILE* out, char *str){
+	if (!strpbrk(str, ",\"\n\r")){
+		fputs(str, out);
+		return;
+	}
+	fputc('"', out);
+	for (char *c = str; *c; c++){
+		if (*c == '"')
+			fputc('"', out);
+		fputc(*c, out);
+	}
+	fputc('"', out);
+}
+
+/*
+ * Write a JSON string.
+ */
+void TMBatch_json(FILE* out, char *str){
+	fputc('"', out);
+	for (unsigned char *c = (unsigned char*)str; *c; c++)
+		if (*c == '"' || *c == '\\')
+			fprintf(out, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(out, "\\u%04x", *c);
+		else
+			fputc(*c, out);
+	fputc('"', out);
+}
+
+/*
+ * Write the results line of a machine.
+ */
+void TMBatch_write(TMBatch* b, TMBatchResult* r){
+	pthread_mutex_lock(&b->lock);
+	if (b->json){
+		fprintf(b->out, "{\"file\":");
+		TMBatch_json(b->out, r->path);
+		fprintf(b->out, ",\"status\":\"%s\",\"state\":", r->status);
+		if (r->state)
+			TMBatch_json(b->out, r->state);
+		else
+			fprintf(b->out, "null");
+		if (r->blank)
+			fprintf(b->out, ",\"steps\":%lu,\"left\":null,\"right\":null", r->steps);
+		else
+			fprintf(b->out, ",\"steps\":%lu,\"left\":%ld,\"right\":%ld", r->steps, r->left, r->right);
+		fprintf(b->out, ",\"time\":%.6f}\n", r->time);
+	} else {
+		TMBatch_csv(b->out, r->path);
+		fprintf(b->out, ",%s,", r->status);
+		if (r->state)
+			TMBatch_csv(b->out, r->state);
+		if (r->blank)
+			fprintf(b->out, ",%lu,,", r->steps);
+		else
+			fprintf(b->out, ",%lu,%ld,%ld", r->steps, r->left, r->right);
+		fprintf(b->out, ",%.6f\n", r->time);
+	}
+	if (strcmp(r->status, TM_BATCH_ERROR) == 0)
+		b->errors++;
+	pthread_mutex_unlock(&b->lock);
+}
+
+/*
+ * Parse, compile and run a machine file within the limits.
+ */
+void TMBatch_machine(TMBatch* b, char *path){
+	double start = TMBatch_clock();
+	TMBatchResult r = { path, TM_BATCH_ERROR, NULL, 0, true, 0, 0, 0 };
+	TMExecutable* exec = TMC_open(path, NULL, true, b->cache);
+	if (!exec){
+		r.time = TMBatch_clock() - start;
+		TMBatch_write(b, &r);
+		return;
+	}
+	TMThreaded* threaded = TMThreaded_init(exec->machine, exec->tape->bits);
+	TMTape* tape = exec->tape;
+
+	while (true){
+		if (!tape->state){
+			r.status = TM_BATCH_UNDEFINED;
+			break;
+		}
+		if (exec->machine->ok[tape->state - 1]){
+			r.status = TM_BATCH_HALTED;
+			break;
+		}
+		if (b->max && r.steps == b->max){
+			r.status = TM_BATCH_STEPS;
+			break;
+		}
+		if (b->limit && TMBatch_clock() - start >= b->limit){
+			r.status = TM_BATCH_TIME;
+			break;
+		}
+		uint64_t chunk = TM_BATCH_CHUNK;
+		if (b->max && b->max - r.steps < chunk)
+			chunk = b->max - r.steps;
+		r.steps += TMThreaded_run(threaded, tape, chunk);
+	}
+
+	r.state = TMDict_at(exec->states, tape->state);
+	r.blank = !TMTape_span(tape, &r.left, &r.right);
+	r.time = TMBatch_clock() - start;
+	TMBatch_write(b, &r);
+
+	TMThreaded_free(threaded);
+	TMExecutable_free(exec);
+}
+
+void* TMBatch_work(void *arg){
+	TMBatch* b = arg;
+	for (size_t i; (i = atomic_fetch_add(&b->next, 1)) < b->n;)
+		TMBatch_machine(b, b->paths[i]);
+	return NULL;
+}
+
+uint64_t TMBatch_run(TMBatch* b){
+	if (!b->json)
+		fprintf(b->out, "file,status,state,steps,left,right,time\n");
+	unsigned n = b->threads < b->n ? b->threads : b->n;
+	pthread_t *threads = NEWARR(pthread_t, n);
+	assert(threads || !n);
+	for (unsigned i = 0; i < n; i++)
+		pthread_create(&threads[i], NULL, TMBatch_work, b);
+	for (unsigned i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	fflush(b->out);
+	return b->errors;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "core.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * Steps run between checks of the time limit.
+ */
+#define TM_BATCH_CHUNK 10000000
+
+#define TM_BATCH_HALTED "halted"        // reached a final state
+#define TM_BATCH_UNDEFINED "undefined"  // reached an undefined transition
+#define TM_BATCH_STEPS "steps"          // still running after the step limit
+#define TM_BATCH_TIME "time"            // still running after the time limit
+#define TM_BATCH_ERROR "error"          // could not be parsed
+
+/*
+ * Outcome of a machine of the batch.
+ */
+typedef struct {
+	char *path;
+	const char *status;     // one of TM_BATCH_*
+	char *state;            // name of the last state (NULL if undefined)
+	uint64_t steps;
+	bool blank;             // no non-blank cells in the blocks in use
+	int64_t left, right;    // leftmost and rightmost non-blank cells
+	double time;            // wall time in seconds, parsing included
+} TMBatchResult;
+
+/*
+ * Runner of many machine files on a pool of threads, each of them
+ * taking the next file, loading (see TMC_open) and running it with
+ * the threaded engine, then writing a line to `out`:
+ *     file,status,state,steps,left,right,time
+ * (CSV with a header) or a JSON object per line. Lines are written
+ * in the order the machines finish.
+ */
+typedef struct {
+	char **paths;
+	size_t n, size;
+	uint64_t max;           // step limit of a machine (0 for none)
+	double limit;           // time limit of a machine in seconds (0 for none)
+	bool json;
+	bool cache;             // look compiled machines up in the cache (see TMC_open)
+	unsigned threads;
+	atomic_size_t next;     // index of the next machine to run
+	FILE *out;
+	pthread_mutex_t lock;   // of `out` and `errors`
+	uint64_t errors;        // machines which could not be parsed
+} TMBatch;
+
+TMBatch* TMBatch_init(uint64_t max, double limit, bool json, unsigned threads, FILE* out);
+void TMBatch_free(TMBatch*);
+
+/*
+ * Add a machine file, the .dtm files of a directory (in alphabetical
+ * order) or, for `-`, the paths read from stdin (one per line).
+ * Return false (with a message) if the path cannot be read.
+ */
+bool TMBatch_add(TMBatch*, char *path);
+
+/*
+ * Write a CSV field, quoted if needed.
+ */
+void TMBatch_csv(FILE*, char *str);
+
+/*
+ * Write a JSON string.
+ */
+void TMBatch_json(FILE*, char *str);
+
+/*
+ * Run all the machines on `threads` threads.
+ * Return the count of machines which could not be parsed.
+ */
+uint64_t TMBatch_run(TMBatch*);
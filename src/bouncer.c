@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "bouncer.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The machine with left and right swapped.
+ */
+TM* TMBouncer_mirror(TM* machine){
+	TM* mirror = TM_init(machine->n, machine->q);
+	for (uint64_t s = 1; s <= machine->q; s++)
+		for (uint64_t a = 0; a < machine->n; a++){
+			uint64_t e = TM_entry(machine, s, a);
+			if (e)
+				TM_define(mirror, s, a, TM_entry_state(machine, e),
+						  TM_entry_symbol(machine, e), !TM_entry_motion(e));
+		}
+	for (uint64_t s = 1; s <= machine->q; s++)
+		if (machine->ok[s - 1])
+			TM_define_final(mirror, s);
+	return mirror;
+}
+
+/*
+ * Fast copy of a tape with left and right swapped
+ * (or a plain copy if `mirror` is not set).
+ */
+TMTape* TMBouncer_tape(TMTape* tape, bool mirror){
+	if (!mirror){
+		TMTape* copy = TMTape_clone(tape);
+		copy->fast = true;
+		return copy;
+	}
+	TMTape* copy = TMTape_init(tape->bits, true);
+	TMTape_prepare(copy);
+	for (int64_t i = -tape->bl * TM_BLOCK_SIZE; i < tape->br * TM_BLOCK_SIZE; i++){
+		uint64_t sym = TMTape_get(tape, i);
+		if (sym)
+			TMTape_write_at(copy, -i, sym);
+	}
+	TMTape_write_at(copy, -tape->pos, TMTape_read_at(copy, -tape->pos));
+	copy->pos = -tape->pos;
+	copy->state = tape->state;
+	return copy;
+}
+
+/*
+ * Add a blank literal cell to the right (left) end.
+ */
+void TMBouncer_extend(TMBouncerTape* t, bool right){
+	if (t->n == t->size){
+		t->size *= 2;
+		t->cells = realloc(t->cells, t->size * sizeof(uint64_t));
+		assert(t->cells);
+	}
+	if (right)
+		t->cells[t->n++] = 0;
+	else {
+		memmove(t->cells + 1, t->cells, t->n++ * sizeof(uint64_t));
+		t->cells[0] = 0;
+		t->at++;
+	}
+}
+
+/*
+ * Move the head across the repeater: run the machine on a single
+ * unit entered from the left (or, unless `right`, from the right).
+ * If the head leaves it on the other side in the state it entered
+ * in, so does it for every next copy, rewriting them alike.
+ */
+bool TMBouncer_cross(TM* machine, TMBouncerTape* t, bool right){
+	int64_t len = t->len, pos = right ? 0 : len - 1;
+	uint64_t state = t->state;
+	for (uint64_t i = 0; pos >= 0 && pos < len; i++){
+		uint64_t e = TM_entry(machine, state, t->unit[pos]);
+		if (i == TM_BOUNCER_CROSS || !(e & TM_GO))
+			return false;
+		t->unit[pos] = TM_entry_symbol(machine, e);
+		state = TM_entry_state(machine, e);
+		pos += TM_entry_motion(e) ? 1 : -1;
+	}
+	return (pos == len) == right && state == t->state;
+}
+
+/*
+ * Write the cells of `t` with `k` copies of the unit to `out`.
+ * Return the count of cells.
+ */
+size_t TMBouncer_expand(TMBouncerTape* t, size_t k, uint64_t* out){
+	size_t m = 0;
+	memcpy(out, t->cells, t->at * sizeof(uint64_t));
+	m += t->at;
+	for (size_t j = 0; j < k; j++, m += t->len)
+		memcpy(out + m, t->unit, t->len * sizeof(uint64_t));
+	memcpy(out + m, t->cells + t->at, (t->n - t->at) * sizeof(uint64_t));
+	return m + t->n - t->at;
+}
+
+/*
+ * Whether `a` with `k` copies and `b` with `k`+1 copies of their
+ * units are the same configuration for every `k`. Leading blanks
+ * do not count; both prefixes before the repeaters shall have a
+ * non-blank cell, so that only a fixed count of them is dropped.
+ *
+ * With prefixes (blanks dropped) of lengths `pa` <= `pb` and units
+ * of length `p`, inserting a copy of the last `p` cells before
+ * position `pb`+`p` extends both repeaters once `k`*`p` >= `pb`-`pa`+`p`:
+ * equality for that `k` implies equality for `k`+1, so the first
+ * values of `k` up to this one are compared by expanding.
+ */
+bool TMBouncer_same(TMBouncerTape* a, TMBouncerTape* b){
+	size_t p = a->len, la = 0, lb = 0;
+	if (b->len != p || a->state != b->state || a->n - a->head != b->n - b->head)
+		return false;
+	while (la < a->at && !a->cells[la])
+		la++;
+	while (lb < b->at && !b->cells[lb])
+		lb++;
+	if (la == a->at || lb == b->at)
+		return false;
+	size_t pa = a->at - la, pb = b->at - lb + p;
+	if (pa + a->n - a->at != pb + b->n - b->at)
+		return false;
+	size_t d = pa > pb ? pa - pb : pb - pa, last = (d + p - 1) / p + 1,
+		   size = (a->n > b->n ? a->n : b->n) + (last + 2) * p;
+	uint64_t *x = NEWARR(uint64_t, size), *y = NEWARR(uint64_t, size);
+	assert(x && y);
+	bool same = true;
+	for (size_t k = 0; same && k <= last; k++){
+		size_t m = TMBouncer_expand(a, k, x) - la;
+		TMBouncer_expand(b, k + 1, y);
+		same = memcmp(x + la, y + lb, m * sizeof(uint64_t)) == 0;
+	}
+	free(x);
+	free(y);
+	return same;
+}
+
+/*
+ * Run the machine symbolically from `start` (the head at its
+ * right end, in a cell never visited before), crossing the repeater
+ * at once. Return true if it reaches `start` with one more copy
+ * of the unit at a new record position: by induction, the machine
+ * then never halts.
+ */
+bool TMBouncer_verify(TM* machine, TMBouncerTape* start){
+	TMBouncerTape t = *start;
+	t.size = 2 * t.n;
+	t.cells = NEWARR(uint64_t, t.size);
+	t.unit = NEWARR(uint64_t, t.len);
+	assert(t.cells && t.unit);
+	memcpy(t.cells, start->cells, t.n * sizeof(uint64_t));
+	memcpy(t.unit, start->unit, t.len * sizeof(uint64_t));
+
+	bool proven = false;
+	for (uint64_t i = 0; i < TM_BOUNCER_STEPS; i++){
+		uint64_t e = TM_entry(machine, t.state, t.cells[t.head]);
+		if (!(e & TM_GO))
+			break;
+		t.cells[t.head] = TM_entry_symbol(machine, e);
+		t.state = TM_entry_state(machine, e);
+		bool right = TM_entry_motion(e);
+		if ((right ? t.head + 1 : t.head) == t.at && !TMBouncer_cross(machine, &t, right))
+			break;
+		if (!right){
+			if (t.head)
+				t.head--;
+			else
+				TMBouncer_extend(&t, false);
+			continue;
+		}
+		if (++t.head < t.n)
+			continue;
+		TMBouncer_extend(&t, true);
+		if (t.state == start->state && TMBouncer_same(&t, start)){
+			proven = true;
+			break;
+		}
+	}
+	free(t.cells);
+	free(t.unit);
+	return proven;
+}
+
+/*
+ * Try to explain record `b` as record `a` with a copy of a unit
+ * inserted: `a` = A B and `b` = A X B. Each split is verified
+ * with `a` as the configuration without copies of X.
+ */
+bool TMBouncer_try(TM* machine, TMBouncerRecord* a, TMBouncerRecord* b, uint64_t state){
+	if (b->n <= a->n || b->n - a->n > TM_BOUNCER_UNIT)
+		return false;
+	size_t m = a->n, p = b->n - a->n, pre = 0, suf = 0;
+	while (pre < m && a->cells[pre] == b->cells[pre])
+		pre++;
+	while (suf < m && a->cells[m - 1 - suf] == b->cells[b->n - 1 - suf])
+		suf++;
+	for (size_t i = m - suf; i <= pre && i < m; i++){
+		TMBouncerTape t = { a->cells, m, m, i, b->cells + i, p, m - 1, state };
+		if (TMBouncer_verify(machine, &t))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Look for a proof from records on the right side
+ * (of the mirrored machine, unless `right`).
+ */
+bool TMBouncer_side(TM* machine, TMTape* initial, uint64_t max, bool right, TMBouncer* proof){
+	TM* m = right ? machine : TMBouncer_mirror(machine);
+	TMTape* tape = TMBouncer_tape(initial, !right);
+	uint64_t k = TM_BOUNCER_RECORDS, q = m->q;
+	TMBouncerRecord *records = calloc(q * k, sizeof(TMBouncerRecord)),
+					scratch = { 0 };
+	assert(records);
+
+	// Cells left of `lo` are blank, cells right of `edge` have never been visited.
+	int64_t edge = tape->pos, lo = TMTape_scan(tape, -tape->bl * TM_BLOCK_SIZE, true, 0);
+	for (int64_t i = -tape->bl * TM_BLOCK_SIZE; i < tape->br * TM_BLOCK_SIZE; i++)
+		if (TMTape_get(tape, i) && i > edge)
+			edge = i;
+
+	bool found = false;
+	for (uint64_t step = 1; !found && step <= max; step++){
+		if (!tape->state || m->ok[tape->state - 1])
+			break;
+		int64_t pos = tape->pos;
+		TM_step(m, tape);
+		if (pos < lo && TMTape_get(tape, pos))
+			lo = pos;
+		if (tape->pos <= edge)
+			continue;
+		edge = tape->pos;
+		if (!tape->state || m->ok[tape->state - 1])
+			break;
+
+		lo = TMTape_scan(tape, lo, true, 0);
+		int64_t from = lo < tape->pos ? lo : tape->pos;
+		scratch.step = step;
+		scratch.n = tape->pos - from + 1;
+		if (scratch.n > scratch.size){
+			free(scratch.cells);
+			scratch.size = 2 * scratch.n;
+			scratch.cells = NEWARR(uint64_t, scratch.size);
+			assert(scratch.cells);
+		}
+		TMTape_readmem(tape, from, scratch.n, scratch.cells);
+
+		// Compare with the earlier records in the state, replace the oldest.
+		TMBouncerRecord *same = records + (tape->state - 1) * k, *oldest = same;
+		for (uint64_t i = 0; i < k; i++){
+			TMBouncerRecord *r = same + i;
+			if (r->step < oldest->step)
+				oldest = r;
+			if (!found && r->step && TMBouncer_try(m, r, &scratch, tape->state)){
+				found = true;
+				*proof = (TMBouncer){ right, tape->state, { r->step, step }, scratch.n - r->n };
+			}
+		}
+		TMBouncerRecord swap = *oldest;
+		*oldest = scratch;
+		scratch = swap;
+	}
+
+	for (uint64_t i = 0; i < q * k; i++)
+		free(records[i].cells);
+	free(records);
+	free(scratch.cells);
+	TMTape_free(tape);
+	if (!right)
+		TM_free(m);
+	return found;
+}
+
+bool TMBouncer_decide(TM* machine, TMTape* tape, uint64_t max, TMBouncer* proof){
+	TMTape* blank = NULL;
+	if (!tape){
+		blank = tape = TMTape_init(TMTape_bits(machine->n), true);
+		TMTape_prepare(tape);
+	}
+	bool found = !tape->left.n && !tape->right.n && !tape->nr
+		&& (TMBouncer_side(machine, tape, max, true, proof)
+			|| TMBouncer_side(machine, tape, max, false, proof));
+	if (blank)
+		TMTape_free(blank);
+	return found;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "core.h"
+
+/*
+ * Default count of steps the machine is run for to find records.
+ */
+#define TM_BOUNCER_MAX 1000000
+/*
+ * Records kept per state.
+ */
+#define TM_BOUNCER_RECORDS 3
+/*
+ * Longest repeated unit tried.
+ */
+#define TM_BOUNCER_UNIT 64
+/*
+ * Steps of a symbolic run (crossing the repeater counts as one).
+ */
+#define TM_BOUNCER_STEPS 100000
+/*
+ * Steps allowed while crossing a single unit.
+ */
+#define TM_BOUNCER_CROSS 10000
+
+/*
+ * The head reaching a new record position in state `state`
+ * at step `step`; `cells` are the cells from the leftmost
+ * non-blank one to the head (inclusive).
+ */
+typedef struct {
+	uint64_t step;
+	uint64_t *cells;
+	size_t n, size;
+} TMBouncerRecord;
+
+/*
+ * Symbolic configuration: literal cells with the repeater
+ * (`n` copies of `unit`, `n` arbitrary) right before `cells[at]`.
+ * Cells beyond the literals are blank.
+ */
+typedef struct {
+	uint64_t *cells;
+	size_t n, size, at;
+	uint64_t *unit;
+	size_t len;
+	size_t head;        // head position (a literal cell)
+	uint64_t state;
+} TMBouncerTape;
+
+/*
+ * A proof that the machine never halts: the configurations
+ * at records `step[0]` and `step[1]` (in state `state`) only
+ * differ by a copy of a unit of `unit` cells, and a symbolic run
+ * shows that a configuration with `n` copies always reaches
+ * the one with `n`+1 copies.
+ */
+typedef struct {
+	bool right;         // records are on the right (or left) side
+	uint64_t state;
+	uint64_t step[2];
+	uint64_t unit;
+} TMBouncer;
+
+/*
+ * Try to prove that the machine is a bouncer (its tape grows
+ * linearly, the head sweeping between the edges) by running it
+ * for at most `max` steps from the given tape (or a blank tape
+ * in state 1 if NULL), which is left intact. Tapes with infinite
+ * patterns are not supported. Return true and fill `proof` if
+ * the machine never halts.
+ */
+bool TMBouncer_decide(TM*, TMTape*, uint64_t max, TMBouncer* proof);
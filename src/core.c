@@ -14,7 +14,25 @@
 #include "core.h"
 #include "util.h"
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Count of bits needed to store values 0..n-1.
+ */
+uint8_t bits(uint64_t n){
+	uint8_t k = 1;
+	while (k < 64 && (1ull << k) < n)
+		k++;
+	return k;
+}
 
 TM* TM_init(uint64_t n, uint64_t q){
 	TM* machine = NEWSTR(TM);
@@ -22,20 +40,50 @@ TM* TM_init(uint64_t n, uint64_t q){
 	machine->n = n;
 	machine->q = q;
 	machine->ok = zalloc2(q);     // final states
-	machine->s = zalloc64(n * q); // state transition table
-	machine->a = zalloc64(n * q); // symbol transition table
-	machine->m = zalloc2(n * q);  // motion transition table
+	machine->abits = bits(n);
+	assert(TM_SHIFT + machine->abits + bits(q) <= 64);
+	// Use 32-bit transitions whenever states and symbols fit.
+	machine->width = TM_SHIFT + machine->abits + bits(q) <= 32 ? 4 : 8;
+	machine->t = calloc(n * q, machine->width);
+	assert(machine->t);
+	machine->shared = false;
 	return machine;
 }
 
+/*
+ * Copy a machine.
+ */
+TM* TM_clone(TM* machine){
+	TM* copy = TM_init(machine->n, machine->q);
+	memcpy(copy->ok, machine->ok, machine->q * sizeof(bool));
+	memcpy(copy->t, machine->t, machine->n * machine->q * machine->width);
+	return copy;
+}
+
 void TM_free(TM* machine){
 	free(machine->ok);
-	free(machine->s);
-	free(machine->a);
-	free(machine->m);
+	if (!machine->shared)
+		free(machine->t);
 	free(machine);
 }
 
+/*
+ * Pack a transition table entry.
+ */
+uint64_t TM_pack(TM* machine, uint64_t s_to, uint64_t a_to, bool motion){
+	return s_to << (TM_SHIFT + machine->abits)
+		| a_to << TM_SHIFT
+		| (motion ? TM_RIGHT : 0)
+		| (s_to && !machine->ok[s_to - 1] ? TM_GO : 0);
+}
+
+void TM_store(TM* machine, uint64_t i, uint64_t e){
+	if (machine->width == 4)
+		((uint32_t*)machine->t)[i] = e;
+	else
+		((uint64_t*)machine->t)[i] = e;
+}
+
 /*
  * Define a transition table entry.
  */
@@ -46,9 +94,32 @@ void TM_define(TM* machine,
 			   uint64_t a_to,   // new symbol
 			   bool motion){    // motion direction (boolean, 1 is right)
 	assert(s_from);
-	machine->s[(s_from - 1) * machine->n + a_from] = s_to;
-	machine->a[(s_from - 1) * machine->n + a_from] = a_to;
-	machine->m[(s_from - 1) * machine->n + a_from] = motion;
+	TM_store(machine, (s_from - 1) * machine->n + a_from,
+			 TM_pack(machine, s_to, a_to, motion));
+}
+
+/*
+ * Mark a state as final.
+ */
+void TM_define_final(TM* machine, uint64_t s){
+	TM_define_finals(machine, 1, &s);
+}
+
+/*
+ * Mark states as final with a single pass over the table.
+ */
+void TM_define_finals(TM* machine, uint64_t n, uint64_t *s){
+	for (uint64_t i = 0; i < n; i++){
+		assert(s[i]);
+		machine->ok[s[i] - 1] = true;
+	}
+	// Transitions into the states do not go on anymore.
+	for (uint64_t i = 0; i < machine->n * machine->q && n; i++){
+		uint64_t e = machine->width == 4 ? ((uint32_t*)machine->t)[i] : ((uint64_t*)machine->t)[i];
+		uint64_t to = TM_entry_state(machine, e);
+		if ((e & TM_GO) && machine->ok[to - 1])
+			TM_store(machine, i, e & ~(uint64_t)TM_GO);
+	}
 }
 
 /*
@@ -76,19 +147,23 @@ void TM_define_forall_readonly(TM* machine,
 }
 
 /*
- *           block -1                block 0               block 1
- *                   bkmem<-|->fwmem
- * ~~  +—+—+—+—~  ~~  ~—+—+ | +—+—+—+—~  ~~  ~—+—+  +—+—+—+—~  ~~  ~—+—+  ~~
- * ~~  |0|0|0|0        0|0| | |0|0|0|0        0|0|  |0|0|0|0        0|0|  ~~
- * ~~  +—+—+—+—~  ~~  ~—+—+ | +—+—+—+—~  ~~  ~—+—+  +—+—+—+—~  ~~  ~—+—+  ~~
- *                    -2 -1 |  ^ 1 2 3              <——— BLOCK_SIZE ———>
- *                            pos          state=1
+ *        lcap                          rcap
+ *  <———————————————————>|<————————————————————————————————>
+ *  +—+—+—  ~~  —+—+—+—+—+—+—+—+—+—  ~~  —+—+—+—+—  ~~  —+—+
+ *  | | |        |0|0|0|0|0|0|0|0|        |0|0| |        | |
+ *  +—+—+—  ~~  —+—+—+—+—+—+—+—+—+—  ~~  —+—+—+—+—  ~~  —+—+
+ *  mem          <— bl —>|^ <——————— br ———————>
+ *                  cells pos          state=1
  */
-TMTape* TMTape_init(bool fast){
+TMTape* TMTape_init(uint8_t bits, bool fast){
 	TMTape* tape = NEWSTR(TMTape);
 	assert(tape);
-	tape->bkmem = NULL;
-	tape->fwmem = NULL;
+	assert(bits == 1 || bits == 8 || bits == 16 || bits == 32 || bits == 64);
+	tape->mem = NULL;
+	tape->cells = NULL;
+	tape->bits = bits;
+	tape->lcap = 0;
+	tape->rcap = 0;
 	tape->bl = 0;
 	tape->br = 0;
 	tape->pos = 0;
@@ -96,17 +171,63 @@ TMTape* TMTape_init(bool fast){
 	tape->fast = fast;
 	tape->left = (TMTapePattern){ 0 };
 	tape->right = (TMTapePattern){ 0 };
+	tape->ranges = NULL;
+	tape->nr = 0;
+	tape->counts = NULL;
+	tape->live = 0;
+	tape->file = NULL;
 	return tape;
 }
 
+/*
+ * Narrowest cell width (in bits) able to store
+ * symbols of an alphabet of the given size.
+ */
+uint8_t TMTape_bits(uint64_t n){
+	if (n <= 2)
+		return 1;
+	if (n <= UINT8_MAX + 1ull)
+		return 8;
+	if (n <= UINT16_MAX + 1ull)
+		return 16;
+	if (n <= UINT32_MAX + 1ull)
+		return 32;
+	return 64;
+}
+
+/*
+ * Write the header of a tape file.
+ */
+static void TMTape_header(TMTape* tape){
+	TMTapeFileHeader h = { TM_TAPE_MAGIC, tape->bits, tape->lcap, tape->rcap,
+						   tape->bl, tape->br, tape->pos, tape->state };
+	if (pwrite(tape->file->fd, &h, sizeof(h), 0) != sizeof(h))
+		fprintf(stderr, "Could not write the tape file header.\n");
+}
+
+/*
+ * Free tape memory (or unmap it from the tape file,
+ * updating the header of the latter).
+ */
+static void TMTape_memfree(TMTape* tape){
+	if (!tape->file)
+		free(tape->mem);
+	else if (tape->mem){
+		TMTape_header(tape);
+		munmap(tape->mem, (tape->lcap + tape->rcap) * tape->bits / 8);
+	}
+}
+
 void TMTape_prepare(TMTape* tape){
-	for (uint64_t i = 0; i < tape->bl; i++)
-		free(tape->bkmem[i]);
-	free(tape->bkmem);
+	TMTape_memfree(tape);
+	free(tape->counts);
+	tape->mem = NULL;
+	tape->cells = NULL;
+	tape->counts = NULL;
+	tape->live = 0;
+	tape->lcap = 0;
+	tape->rcap = 0;
 	tape->bl = 0;
-	for (uint64_t i = 0; i < tape->br; i++)
-		free(tape->fwmem[i]);
-	free(tape->fwmem);
 	tape->br = 0;
 	tape->pos = 0;
 	tape->state = 1;
@@ -116,13 +237,157 @@ void TMTape_prepare(TMTape* tape){
 void TMTape_free(TMTape* tape){
 	free(tape->left.data);
 	free(tape->right.data);
-	for (uint64_t i = 0; i < tape->bl; i++)
-		free(tape->bkmem[i]);
-	for (uint64_t i = 0; i < tape->br; i++)
-		free(tape->fwmem[i]);
+	for (uint64_t i = 0; i < tape->nr; i++)
+		free(tape->ranges[i].data);
+	free(tape->ranges);
+	TMTape_memfree(tape);
+	free(tape->counts);
+	if (tape->file){
+		close(tape->file->fd);
+		free(tape->file);
+	}
 	free(tape);
 }
 
+/*
+ * Copy cells [`pos`..`pos`+`n`-1] of the given type
+ * between tape and `mem` (to `mem` if `read`).
+ */
+#define TMTape_COPYMEM(type, tape, pos, n, mem, read) do {    \
+	type *cells = (type*)(tape)->cells + (pos);               \
+	if (read)                                                 \
+		for (size_t i = 0; i < (n); i++)                      \
+			(mem)[i] = cells[i];                              \
+	else                                                      \
+		for (size_t i = 0; i < (n); i++)                      \
+			cells[i] = (mem)[i];                              \
+} while (0)
+
+void TMTape_copymem(TMTape* tape, int64_t pos, size_t n, uint64_t* mem, bool read){
+	switch (tape->bits){
+		case 1:
+			for (size_t i = 0; i < n; i++)
+				if (read)
+					mem[i] = TMTape_get(tape, pos + i);
+				else
+					TMTape_set(tape, pos + i, mem[i]);
+			break;
+		case 8: TMTape_COPYMEM(uint8_t, tape, pos, n, mem, read); break;
+		case 16: TMTape_COPYMEM(uint16_t, tape, pos, n, mem, read); break;
+		case 32: TMTape_COPYMEM(uint32_t, tape, pos, n, mem, read); break;
+		default:
+			if (read)
+				memcpy(mem, (uint64_t*)tape->cells + pos, n * sizeof(uint64_t));
+			else
+				memcpy((uint64_t*)tape->cells + pos, mem, n * sizeof(uint64_t));
+	}
+}
+
+/*
+ * Find where the undefined cells from `pos` on come from: set `pattern`
+ * to their pattern (NULL if they are blank) and return the last position
+ * of the run of cells coming from it.
+ */
+static int64_t TMTape_source(TMTape* tape, int64_t pos, TMTapePattern** pattern){
+	int64_t last = INT64_MAX;
+	*pattern = NULL;
+	if (tape->nr && pos <= tape->ranges[tape->nr - 1].end){
+		if (pos < tape->ranges[0].start)
+			last = tape->ranges[0].start - 1;
+		else {
+			// The last finite pattern starting at `pos` or before it.
+			uint64_t lo = 0, hi = tape->nr - 1;
+			while (lo < hi){
+				uint64_t mid = (lo + hi + 1) / 2;
+				if (tape->ranges[mid].start <= pos)
+					lo = mid;
+				else
+					hi = mid - 1;
+			}
+			if (pos <= tape->ranges[lo].end){
+				*pattern = &tape->ranges[lo];
+				return tape->ranges[lo].end;
+			}
+			last = tape->ranges[lo + 1].start - 1;
+		}
+	}
+	if (tape->left.n && pos < tape->left.start){
+		*pattern = &tape->left;
+		return last < tape->left.start - 1 ? last : tape->left.start - 1;
+	}
+	if (tape->right.n){
+		if (pos >= tape->right.start)
+			*pattern = &tape->right;
+		else if (tape->right.start - 1 < last)
+			last = tape->right.start - 1;
+	}
+	return last;
+}
+
+uint64_t TMTape_undefined(TMTape* tape, int64_t pos){
+	TMTapePattern* pattern;
+	TMTape_source(tape, pos, &pattern);
+	if (!pattern)
+		return 0;
+	return pattern->data[modulo(pos - pattern->start, pattern->n)];
+}
+
+/*
+ * Write undefined cells [`pos`..`pos`+`n`-1] to `mem`. The phase
+ * of a pattern is found once per run of cells coming from it.
+ */
+static void TMTape_undefinedmem(TMTape* tape, int64_t pos, size_t n, uint64_t* mem){
+	int64_t to = pos + (int64_t)n;
+	while (pos < to){
+		TMTapePattern* pattern;
+		int64_t last = TMTape_source(tape, pos, &pattern),
+				end = last < to - 1 ? last + 1 : to;
+		if (!pattern)
+			memset(mem, 0, (end - pos) * sizeof(uint64_t));
+		else {
+			uint64_t k = modulo(pos - pattern->start, pattern->n);
+			for (int64_t i = 0; i < end - pos; i++){
+				mem[i] = pattern->data[k];
+				if (++k == pattern->n)
+					k = 0;
+			}
+		}
+		mem += end - pos;
+		pos = end;
+	}
+}
+
+/*
+ * Index of the block holding cell `pos`.
+ */
+static inline int64_t TMTape_block(int64_t pos){
+	return (pos & ~(int64_t)(TM_BLOCK_SIZE - 1)) / TM_BLOCK_SIZE;
+}
+
+/*
+ * Counter of block `b` (of a tape which is not fast).
+ */
+static inline uint8_t* TMTape_counter(TMTape* tape, int64_t b){
+	return tape->counts + tape->lcap / TM_BLOCK_SIZE + b;
+}
+
+/*
+ * Count the cells of block `b` differing from the patterns
+ * into its counter, return the count of the non-blank ones.
+ */
+static uint64_t TMTape_countblock(TMTape* tape, int64_t b){
+	uint64_t background[TM_BLOCK_SIZE], cells[TM_BLOCK_SIZE], live = 0;
+	uint8_t count = 0;
+	TMTape_undefinedmem(tape, b * TM_BLOCK_SIZE, TM_BLOCK_SIZE, background);
+	TMTape_copymem(tape, b * TM_BLOCK_SIZE, TM_BLOCK_SIZE, cells, true);
+	for (int i = 0; i < TM_BLOCK_SIZE; i++){
+		count += cells[i] != background[i];
+		live += cells[i] != 0;
+	}
+	*TMTape_counter(tape, b) = count;
+	return live;
+}
+
 /*
  * Write contents of tape to `mem` 
  * from positions [`pos`..`pos`+`n`-1].
@@ -130,8 +395,17 @@ void TMTape_free(TMTape* tape){
  */
 void TMTape_readmem(TMTape* tape, int64_t pos, size_t n, uint64_t* mem){
 	assert(mem);
-	for (int64_t i = pos; i < pos + n; i++)
-		mem[i - pos] = TMTape_read_at(tape, i);
+	int64_t from = pos, to = pos + (int64_t)n;
+	// Cells outside of the blocks in use come from the patterns.
+	if (from < -tape->bl * TM_BLOCK_SIZE){
+		from = to < -tape->bl * TM_BLOCK_SIZE ? to : -tape->bl * TM_BLOCK_SIZE;
+		TMTape_undefinedmem(tape, pos, from - pos, mem);
+	}
+	if (to > tape->br * TM_BLOCK_SIZE){
+		to = from > tape->br * TM_BLOCK_SIZE ? from : tape->br * TM_BLOCK_SIZE;
+		TMTape_undefinedmem(tape, to, pos + (int64_t)n - to, mem + (to - pos));
+	}
+	TMTape_copymem(tape, from, to - from, mem + (from - pos), true);
 }
 
 /*
@@ -139,20 +413,45 @@ void TMTape_readmem(TMTape* tape, int64_t pos, size_t n, uint64_t* mem){
  * into positions [`pos`..`pos`+`n`-1].
  */
 void TMTape_writemem(TMTape* tape, int64_t pos, size_t n, uint64_t* mem){
-	for (int64_t i = pos; i < pos + n; i++)
-		TMTape_write_at(tape, i, mem[i - pos]);
+	if (!n)
+		return;
+	TMTape_write_at(tape, pos, mem[0]);
+	TMTape_write_at(tape, pos + n - 1, mem[n - 1]);
+	int64_t first = TMTape_block(pos), last = TMTape_block(pos + n - 1);
+	if (!tape->fast)
+		for (int64_t b = first; b <= last; b++)
+			tape->live -= TMTape_countblock(tape, b);
+	TMTape_copymem(tape, pos, n, mem, false);
+	if (!tape->fast)
+		for (int64_t b = first; b <= last; b++)
+			tape->live += TMTape_countblock(tape, b);
 }
 
-uint64_t TMTape_undefined(TMTape* tape, int64_t pos){
-	if (tape->left.n && pos < tape->left.start)
-		return tape->left.data[
-			modulo(pos - tape->left.start, tape->left.n)
-		];
-	if (tape->right.n && pos >= tape->right.start)
-		return tape->right.data[
-			modulo(pos - tape->right.start, tape->right.n)
-		];
-	return 0;
+void TMTape_recount(TMTape* tape){
+	if (tape->fast)
+		return;
+	tape->live = 0;
+	for (int64_t b = -tape->bl; b < tape->br; b++)
+		tape->live += TMTape_countblock(tape, b);
+}
+
+/*
+ * Count a write of `sym` into cell `pos` (of a tape which is not fast).
+ */
+static void TMTape_track(TMTape* tape, int64_t pos, uint64_t sym){
+	uint64_t old = TMTape_get(tape, pos);
+	if (old == sym)
+		return;
+	if (!old)
+		tape->live++;
+	else if (!sym)
+		tape->live--;
+	uint64_t background = TMTape_undefined(tape, pos);
+	uint8_t *count = TMTape_counter(tape, TMTape_block(pos));
+	if (old == background)
+		(*count)++;
+	else if (sym == background)
+		(*count)--;
 }
 
 /*
@@ -161,10 +460,7 @@ uint64_t TMTape_undefined(TMTape* tape, int64_t pos){
 uint64_t TMTape_read_at(TMTape* tape, int64_t pos){
 	if (pos < -tape->bl * TM_BLOCK_SIZE || pos >= tape->br * TM_BLOCK_SIZE)
 		return TMTape_undefined(tape, pos);
-	if (pos < 0)
-		return tape->bkmem[(-1 - pos) / TM_BLOCK_SIZE][(-1 - pos) % TM_BLOCK_SIZE];
-	else
-		return tape->fwmem[pos / TM_BLOCK_SIZE][pos % TM_BLOCK_SIZE];
+	return TMTape_get(tape, pos);
 }
 
 /*
@@ -175,56 +471,320 @@ void TMTape_write_at(TMTape* tape, int64_t pos, uint64_t sym){
 		TMTape_alloc(tape, false);
 	while (pos >= tape->br * TM_BLOCK_SIZE)
 		TMTape_alloc(tape, true);
-	if (pos < 0)
-		tape->bkmem[(-1 - pos) / TM_BLOCK_SIZE][(-1 - pos) % TM_BLOCK_SIZE] = sym;
-	else
-		tape->fwmem[pos / TM_BLOCK_SIZE][pos % TM_BLOCK_SIZE] = sym;
+	if (!tape->fast)
+		TMTape_track(tape, pos, sym);
+	TMTape_set(tape, pos, sym);
 }
 
 /*
  * Read a symbol at the current position.
  */
 uint64_t TMTape_read(TMTape* tape){
-	if (tape->pos < 0)
-		return tape->bkmem[(-1 - tape->pos) / TM_BLOCK_SIZE][(-1 - tape->pos) % TM_BLOCK_SIZE];
-	else
-		return tape->fwmem[tape->pos / TM_BLOCK_SIZE][tape->pos % TM_BLOCK_SIZE];
+	return TMTape_get(tape, tape->pos);
 }
 
 /*
  * Write a symbol at the current position.
  */
 void TMTape_write(TMTape* tape, uint64_t sym){
-	if (tape->pos < 0)
-		tape->bkmem[(-1 - tape->pos) / TM_BLOCK_SIZE][(-1 - tape->pos) % TM_BLOCK_SIZE] = sym;
+	if (!tape->fast)
+		TMTape_track(tape, tape->pos, sym);
+	TMTape_set(tape, tape->pos, sym);
+}
+
+/*
+ * Allocate `size` bytes of tape memory, aligned to
+ * a cache line (or to a huge page for large tapes).
+ */
+void* TMTape_memalloc(size_t size){
+	void *mem = NULL;
+	if (size >= TM_TAPE_HUGE_ALIGN){
+		size = (size + TM_TAPE_HUGE_ALIGN - 1) & ~(size_t)(TM_TAPE_HUGE_ALIGN - 1);
+		if (posix_memalign(&mem, TM_TAPE_HUGE_ALIGN, size))
+			mem = NULL;
+#ifdef MADV_HUGEPAGE
+		else
+			madvise(mem, size, MADV_HUGEPAGE);
+#endif
+	} else if (posix_memalign(&mem, TM_TAPE_ALIGN, size))
+		mem = NULL;
+	assert(mem);
+	return mem;
+}
+
+/*
+ * Copy a pattern's data.
+ */
+TMTapePattern TMTapePattern_clone(TMTapePattern pattern){
+	if (pattern.data){
+		uint64_t *data = NEWARR(uint64_t, pattern.n);
+		assert(data);
+		memcpy(data, pattern.data, pattern.n * sizeof(uint64_t));
+		pattern.data = data;
+	}
+	return pattern;
+}
+
+/*
+ * Copy a tape (memory and patterns included).
+ */
+TMTape* TMTape_clone(TMTape* tape){
+	TMTape* copy = NEWSTR(TMTape);
+	assert(copy);
+	*copy = *tape;
+	copy->file = NULL;
+	if (tape->mem){
+		size_t size = (tape->lcap + tape->rcap) * tape->bits / 8;
+		copy->mem = TMTape_memalloc(size);
+		memcpy(copy->mem, tape->mem, size);
+		copy->cells = (uint8_t*)copy->mem + ((uint8_t*)tape->cells - (uint8_t*)tape->mem);
+	}
+	if (tape->counts){
+		size_t size = (tape->lcap + tape->rcap) / TM_BLOCK_SIZE;
+		copy->counts = NEWARR(uint8_t, size);
+		assert(copy->counts);
+		memcpy(copy->counts, tape->counts, size);
+	}
+	copy->left = TMTapePattern_clone(tape->left);
+	copy->right = TMTapePattern_clone(tape->right);
+	if (tape->nr){
+		copy->ranges = NEWARR(TMTapePattern, tape->nr);
+		assert(copy->ranges);
+		for (uint64_t i = 0; i < tape->nr; i++)
+			copy->ranges[i] = TMTapePattern_clone(tape->ranges[i]);
+	}
+	return copy;
+}
+
+/*
+ * Write the blocks in use, the head and the state to a file.
+ * Patterns are not saved (they come with the machine).
+ */
+bool TMTape_save(TMTape* tape, FILE* file){
+	int64_t header[5] = { tape->bits, tape->bl, tape->br, tape->pos, tape->state };
+	size_t size = (tape->bl + tape->br) * TM_BLOCK_SIZE * tape->bits / 8;
+	uint8_t *mem = (uint8_t*)tape->cells - tape->bl * TM_BLOCK_SIZE * tape->bits / 8;
+	return fwrite(header, sizeof(header), 1, file) == 1
+		&& fwrite(mem, 1, size, file) == size;
+}
+
+/*
+ * Read a tape written by TMTape_save into a tape of the same width.
+ * The blocks shall fill the rest of the file, the head shall be
+ * in them and the state below `q`.
+ */
+bool TMTape_load(TMTape* tape, FILE* file, uint64_t q){
+	int64_t header[5];
+	struct stat st;
+	if (fread(header, sizeof(header), 1, file) != 1 || header[0] != tape->bits
+		|| header[1] < 0 || header[2] < 0 || fstat(fileno(file), &st))
+		return false;
+	int64_t left = st.st_size - ftell(file);
+	if (header[1] > left || header[2] > left
+		|| (header[1] + header[2]) * TM_BLOCK_SIZE * tape->bits / 8 != left
+		|| header[3] < -header[1] * TM_BLOCK_SIZE || header[3] >= header[2] * TM_BLOCK_SIZE
+		|| (uint64_t)header[4] >= q)
+		return false;
+	TMTape_prepare(tape);
+	while (tape->bl < header[1])
+		TMTape_alloc(tape, false);
+	while (tape->br < header[2])
+		TMTape_alloc(tape, true);
+	size_t size = (tape->bl + tape->br) * TM_BLOCK_SIZE * tape->bits / 8;
+	uint8_t *mem = (uint8_t*)tape->cells - tape->bl * TM_BLOCK_SIZE * tape->bits / 8;
+	if (fread(mem, 1, size, file) != size)
+		return false;
+	TMTape_recount(tape);
+	tape->pos = header[3];
+	tape->state = header[4];
+	return true;
+}
+
+/*
+ * Map a tape file again with the given capacities (it is extended,
+ * holes taking no space), moving the blocks in use to their place.
+ */
+static uint8_t* TMTape_remap(TMTape* tape, int64_t lcap, int64_t rcap){
+	uint8_t bits = tape->bits, *mem = MAP_FAILED;
+	size_t size = (lcap + rcap) * bits / 8;
+	int fd = tape->file->fd;
+	if (tape->mem)
+		munmap(tape->mem, (tape->lcap + tape->rcap) * bits / 8);
+	if (!ftruncate(fd, TM_TAPE_SEGMENT + size))
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, TM_TAPE_SEGMENT);
+	assert(mem != MAP_FAILED);
+	if (tape->mem && lcap != tape->lcap)
+		memmove(mem + (lcap - tape->bl * TM_BLOCK_SIZE) * bits / 8,
+				mem + (tape->lcap - tape->bl * TM_BLOCK_SIZE) * bits / 8,
+				(tape->bl + tape->br) * TM_BLOCK_SIZE * bits / 8);
+	return mem;
+}
+
+bool TMTape_map(TMTape* tape, char *path, uint64_t memory){
+	assert(tape->mem && !tape->file);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	TMTapeFile* file = NEWSTR(TMTapeFile);
+	assert(file);
+	file->fd = fd;
+	file->hot = memory / TM_TAPE_SEGMENT ? memory / TM_TAPE_SEGMENT : 1;
+	file->anchor = 0;
+	uint8_t bits = tape->bits;
+	size_t size = (tape->lcap + tape->rcap) * bits / 8,
+		   offset = (tape->lcap - tape->bl * TM_BLOCK_SIZE) * bits / 8;
+	uint8_t *mem = MAP_FAILED;
+	if (!ftruncate(fd, TM_TAPE_SEGMENT + size))
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, TM_TAPE_SEGMENT);
+	if (mem == MAP_FAILED){
+		close(fd);
+		free(file);
+		return false;
+	}
+	memcpy(mem + offset, (uint8_t*)tape->mem + offset, (tape->bl + tape->br) * TM_BLOCK_SIZE * bits / 8);
+	free(tape->mem);
+	tape->mem = mem;
+	tape->cells = mem + tape->lcap * bits / 8;
+	tape->file = file;
+	TMTape_header(tape);
+	return true;
+}
+
+/*
+ * Page a range of a tape file out (its dirty pages are written back).
+ */
+static void TMTape_pageout(uint8_t *mem, size_t size){
+#ifdef MADV_PAGEOUT
+	if (!madvise(mem, size, MADV_PAGEOUT))
+		return;
+#endif
+	madvise(mem, size, MADV_DONTNEED);
+}
+
+void TMTape_release(TMTape* tape){
+	TMTapeFile* file = tape->file;
+	if (!file || !tape->mem)
+		return;
+	int64_t size = (tape->lcap + tape->rcap) * tape->bits / 8,
+			head = (tape->lcap + tape->pos) * tape->bits / 8 / TM_TAPE_SEGMENT;
+	if (2 * llabs(head - file->anchor) < (int64_t)file->hot)
+		return;
+	file->anchor = head;
+	// Segments [lo..hi-1] are kept.
+	int64_t lo = head - (int64_t)file->hot / 2, hi = lo + file->hot;
+	if (lo > 0)
+		TMTape_pageout(tape->mem, lo * TM_TAPE_SEGMENT);
+	if (hi * TM_TAPE_SEGMENT < size)
+		TMTape_pageout((uint8_t*)tape->mem + hi * TM_TAPE_SEGMENT, size - hi * TM_TAPE_SEGMENT);
+	TMTape_header(tape);
+}
+
+/*
+ * Grow tape memory in the given direction so that
+ * at least one more block fits there.
+ */
+void TMTape_grow(TMTape* tape, bool right){
+	int64_t lcap = tape->lcap, rcap = tape->rcap;
+	if (right)
+		rcap = rcap ? 2 * rcap : TM_TAPE_CAPACITY;
 	else
-		tape->fwmem[tape->pos / TM_BLOCK_SIZE][tape->pos % TM_BLOCK_SIZE] = sym;
+		lcap = lcap ? 2 * lcap : TM_TAPE_CAPACITY;
+	if (!tape->mem){
+		lcap = lcap ? lcap : TM_TAPE_CAPACITY;
+		rcap = rcap ? rcap : TM_TAPE_CAPACITY;
+	}
+	// Capacities are multiples of 64 cells, so blocks and
+	// one-bit cell words are always whole bytes.
+	uint8_t bits = tape->bits, *mem;
+	if (tape->file)
+		mem = TMTape_remap(tape, lcap, rcap);
+	else {
+		mem = TMTape_memalloc((lcap + rcap) * bits / 8);
+		if (tape->mem)
+			memcpy(mem + (lcap - tape->bl * TM_BLOCK_SIZE) * bits / 8,
+				   (uint8_t*)tape->cells - tape->bl * TM_BLOCK_SIZE * bits / 8,
+				   (tape->bl + tape->br) * TM_BLOCK_SIZE * bits / 8);
+		free(tape->mem);
+	}
+	tape->mem = mem;
+	tape->cells = mem + lcap * bits / 8;
+	if (!tape->fast){
+		uint8_t *counts = NEWARR(uint8_t, (lcap + rcap) / TM_BLOCK_SIZE);
+		assert(counts);
+		if (tape->counts)
+			memcpy(counts + lcap / TM_BLOCK_SIZE - tape->bl,
+				   TMTape_counter(tape, -tape->bl), tape->bl + tape->br);
+		free(tape->counts);
+		tape->counts = counts;
+	}
+	tape->lcap = lcap;
+	tape->rcap = rcap;
+}
+
+/*
+ * Fill the block at `pos` with undefined cells: blank blocks
+ * at once, other ones from the runs of the patterns.
+ * Return the count of non-blank cells.
+ */
+static uint64_t TMTape_fillblock(TMTape* tape, int64_t pos){
+	TMTapePattern* pattern;
+	if (TMTape_source(tape, pos, &pattern) >= pos + TM_BLOCK_SIZE - 1 && !pattern){
+		TMTape_fill(tape, pos, TM_BLOCK_SIZE, 0);
+		return 0;
+	}
+	uint64_t block[TM_BLOCK_SIZE], live = 0;
+	TMTape_undefinedmem(tape, pos, TM_BLOCK_SIZE, block);
+	TMTape_copymem(tape, pos, TM_BLOCK_SIZE, block, false);
+	for (int i = 0; i < TM_BLOCK_SIZE; i++)
+		live += block[i] != 0;
+	return live;
 }
 
 /*
- * Allocate a memory block in the given direction.
+ * Take a memory block into use in the given direction,
+ * growing the tape memory if needed.
  */
 void TMTape_alloc(TMTape* tape, bool right){
-	uint64_t *block = NEWARR(uint64_t, TM_BLOCK_SIZE);
-	assert(block);
-	for (uint64_t i = 0; i < TM_BLOCK_SIZE; i++)
-		if (right)
-			block[i] = TMTape_read_at(tape, tape->br * TM_BLOCK_SIZE + i);
-		else
-			block[i] = TMTape_read_at(tape, -(tape->bl + 1) * TM_BLOCK_SIZE + i);
 	if (right){
-		tape->fwmem = realloc(tape->fwmem, (tape->br + 1) * sizeof(uint64_t*));
-		assert(tape->fwmem);
-		tape->fwmem[tape->br] = block;
+		if ((tape->br + 1) * TM_BLOCK_SIZE > tape->rcap)
+			TMTape_grow(tape, true);
+		uint64_t live = TMTape_fillblock(tape, tape->br * TM_BLOCK_SIZE);
+		if (!tape->fast){
+			*TMTape_counter(tape, tape->br) = 0;
+			tape->live += live;
+		}
 		tape->br++;
 	} else {
-		tape->bkmem = realloc(tape->bkmem, (tape->bl + 1) * sizeof(uint64_t*));
-		assert(tape->bkmem);
-		tape->bkmem[tape->bl] = block;
+		if ((tape->bl + 1) * TM_BLOCK_SIZE > tape->lcap)
+			TMTape_grow(tape, false);
+		uint64_t live = TMTape_fillblock(tape, -(tape->bl + 1) * TM_BLOCK_SIZE);
+		if (!tape->fast){
+			*TMTape_counter(tape, -(tape->bl + 1)) = 0;
+			tape->live += live;
+		}
 		tape->bl++;
 	}
 }
 
+/*
+ * Trim the edge blocks on the given side where no cell differs
+ * from the patterns, keeping TM_TAPE_SLACK blocks next to the head.
+ */
+static void TMTape_trim(TMTape* tape, bool right){
+	if (right)
+		while (tape->br > 0 && tape->pos < (tape->br - 1 - TM_TAPE_SLACK) * TM_BLOCK_SIZE
+			   && !*TMTape_counter(tape, tape->br - 1)){
+			tape->live -= TMTape_countblock(tape, tape->br - 1);
+			tape->br--;
+		}
+	else
+		while (tape->bl > 0 && tape->pos >= -(tape->bl - 1 - TM_TAPE_SLACK) * TM_BLOCK_SIZE
+			   && !*TMTape_counter(tape, -tape->bl)){
+			tape->live -= TMTape_countblock(tape, -tape->bl);
+			tape->bl--;
+		}
+}
+
 /*
  * Move the pointer in the given direction.
  */
@@ -233,66 +793,480 @@ void TMTape_step(TMTape* tape, bool right){
 		if (tape->pos == tape->br * TM_BLOCK_SIZE - 1)
 			TMTape_alloc(tape, 1);
 		tape->pos++;
-		if (!tape->fast && tape->bl > 0 && tape->pos >= -(tape->bl - 1) * TM_BLOCK_SIZE){
-			for (int64_t i = -tape->bl * TM_BLOCK_SIZE; i < -(tape->bl - 1) * TM_BLOCK_SIZE; i++)
-				if ((!tape->right.n && TMTape_read_at(tape, i)) ||
-					(tape->right.n && TMTape_read_at(tape, i) != tape->right.data[
-						modulo(i - tape->right.start, tape->right.n)
-					]))
-					return;
-			free(tape->bkmem[tape->bl - 1]);
-			tape->bl--;
-			tape->bkmem = realloc(tape->bkmem, tape->bl * sizeof(uint64_t*));
-			assert(tape->bl == 0 || tape->bkmem);
-		}
 	} else {
 		if (-tape->pos == tape->bl * TM_BLOCK_SIZE)
 			TMTape_alloc(tape, 0);
 		tape->pos--;
-		if (!tape->fast && tape->br > 0 && tape->pos <= (tape->br - 1) * TM_BLOCK_SIZE - 1){
-			for (int64_t i = (tape->br - 1) * TM_BLOCK_SIZE; i < tape->br * TM_BLOCK_SIZE; i++)
-				if ((!tape->left.n && TMTape_read_at(tape, i)) ||
-					(tape->left.n && TMTape_read_at(tape, i) != tape->left.data[
-						modulo(i - tape->left.start, tape->left.n)
-					]))
-					return;
-			free(tape->fwmem[tape->br - 1]);
-			tape->br--;
-			tape->fwmem = realloc(tape->fwmem, tape->br * sizeof(uint64_t*));
-			assert(tape->br == 0 || tape->fwmem);
+	}
+	if (!tape->fast)
+		TMTape_trim(tape, !right);
+}
+
+#if defined(__SSE2__)
+/*
+ * Vector width (in bytes) used to scan the tape.
+ */
+#if defined(__AVX2__)
+#define TM_VECTOR 32
+#else
+#define TM_VECTOR 16
+#endif
+
+/*
+ * Mask of the bytes of TM_VECTOR bytes at `p` belonging to cells
+ * of `size` bytes which differ from `sym`.
+ */
+static inline uint32_t TMTape_vector_diff(uint8_t *p, uint64_t sym, uint8_t size){
+#if defined(__AVX2__)
+	__m256i v = _mm256_loadu_si256((__m256i*)p), eq;
+	switch (size){
+		case 1: eq = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(sym)); break;
+		case 2: eq = _mm256_cmpeq_epi16(v, _mm256_set1_epi16(sym)); break;
+		default: eq = _mm256_cmpeq_epi32(v, _mm256_set1_epi32(sym));
+	}
+	return ~(uint32_t)_mm256_movemask_epi8(eq);
+#else
+	__m128i v = _mm_loadu_si128((__m128i*)p), eq;
+	switch (size){
+		case 1: eq = _mm_cmpeq_epi8(v, _mm_set1_epi8(sym)); break;
+		case 2: eq = _mm_cmpeq_epi16(v, _mm_set1_epi16(sym)); break;
+		default: eq = _mm_cmpeq_epi32(v, _mm_set1_epi32(sym));
+	}
+	return _mm_movemask_epi8(eq) ^ 0xFFFF;
+#endif
+}
+#endif
+
+/*
+ * Find the first cell from `pos` on (in the given direction)
+ * which is not `sym`. The scan stops at the edge of the blocks
+ * in use, returning the first position outside of them.
+ */
+int64_t TMTape_scan(TMTape* tape, int64_t pos, bool right, uint64_t sym){
+	int64_t lo = -tape->bl * TM_BLOCK_SIZE, hi = tape->br * TM_BLOCK_SIZE - 1;
+	if (pos < lo || pos > hi)
+		return pos < lo ? lo - 1 : hi + 1;
+	if (tape->bits == 1){
+		// Compare 64 cells at once: set bits are the cells differing from `sym`.
+		uint64_t *w = tape->cells, fill = sym ? ~0ull : 0;
+		for (;;){
+			uint64_t diff = w[pos >> 6] ^ fill;
+			if (right){
+				diff &= ~0ull << (pos & 63);
+				if (diff)
+					return (pos & ~63ll) + __builtin_ctzll(diff) > hi ?
+						hi + 1 : (pos & ~63ll) + __builtin_ctzll(diff);
+				pos = (pos & ~63ll) + 64;
+				if (pos > hi)
+					return hi + 1;
+			} else {
+				diff &= ~0ull >> (63 - (pos & 63));
+				if (diff)
+					return (pos & ~63ll) + 63 - __builtin_clzll(diff) < lo ?
+						lo - 1 : (pos & ~63ll) + 63 - __builtin_clzll(diff);
+				pos = (pos & ~63ll) - 1;
+				if (pos < lo)
+					return lo - 1;
+			}
+		}
+	}
+#if defined(__SSE2__)
+	if (tape->bits <= 32){
+		// Compare a vector of cells at once: set mask bits are the bytes differing from `sym`.
+		uint8_t size = tape->bits / 8, *cells = tape->cells;
+		int64_t n = TM_VECTOR / size;
+		if (right)
+			for (; pos + n - 1 <= hi; pos += n){
+				uint32_t diff = TMTape_vector_diff(cells + pos * size, sym, size);
+				if (diff)
+					return pos + __builtin_ctz(diff) / size;
+			}
+		else
+			for (; pos - (n - 1) >= lo; pos -= n){
+				uint32_t diff = TMTape_vector_diff(cells + (pos - (n - 1)) * size, sym, size);
+				if (diff)
+					return pos - (n - 1) + (31 - __builtin_clz(diff)) / size;
+			}
+	}
+#endif
+	while (pos >= lo && pos <= hi && TMTape_get(tape, pos) == sym)
+		pos += right ? 1 : -1;
+	return pos < lo ? lo - 1 : pos > hi ? hi + 1 : pos;
+}
+
+/*
+ * Write `sym` into cells [`pos`..`pos`+`n`-1].
+ */
+void TMTape_fill(TMTape* tape, int64_t pos, uint64_t n, uint64_t sym){
+	int64_t end = pos + n;
+	switch (tape->bits){
+		case 1: {
+			uint64_t *w = tape->cells, fill = sym ? ~0ull : 0;
+			while (pos < end){
+				uint64_t bit = pos & 63,
+						 count = end - pos < 64 - (int64_t)bit ? end - pos : 64 - bit,
+						 mask = (count == 64 ? ~0ull : (1ull << count) - 1) << bit;
+				w[pos >> 6] = (w[pos >> 6] & ~mask) | (fill & mask);
+				pos += count;
+			}
+			break;
 		}
+		case 8:
+			memset((uint8_t*)tape->cells + pos, sym, n);
+			break;
+		case 16:
+			for (uint16_t *c = (uint16_t*)tape->cells + pos; pos < end; pos++)
+				*c++ = sym;
+			break;
+		case 32:
+			for (uint32_t *c = (uint32_t*)tape->cells + pos; pos < end; pos++)
+				*c++ = sym;
+			break;
+		default:
+			for (uint64_t *c = (uint64_t*)tape->cells + pos; pos < end; pos++)
+				*c++ = sym;
 	}
 }
 
+/*
+ * Find the leftmost and rightmost non-blank cells of the blocks
+ * in use and of the finite patterns. Return false (leaving `left`
+ * and `right` as they are) if there are none.
+ */
+bool TMTape_span(TMTape* tape, int64_t *left, int64_t *right){
+	int64_t lo = -tape->bl * TM_BLOCK_SIZE, end = tape->br * TM_BLOCK_SIZE,
+			l = INT64_MAX, r = INT64_MIN;
+	// Unless the tape is fast, its edge blocks are trimmed
+	// and the scans end close to them.
+	int64_t first = !tape->fast && !tape->live ? end : TMTape_scan(tape, lo, true, 0);
+	if (first < end){
+		l = first;
+		r = TMTape_scan(tape, end - 1, false, 0);
+	}
+	// Parts of the finite patterns outside of the blocks in use.
+	for (uint64_t i = 0; i < tape->nr; i++){
+		TMTapePattern* range = &tape->ranges[i];
+		int64_t parts[2][2] = {
+			{ range->start, range->end < lo - 1 ? range->end : lo - 1 },
+			{ range->start > end ? range->start : end, range->end }
+		};
+		for (int p = 0; p < 2; p++){
+			int64_t a = parts[p][0], b = parts[p][1];
+			for (uint64_t k = 0; k < range->n && a + (int64_t)k <= b; k++)
+				if (range->data[(a + k - range->start) % range->n]){
+					l = a + (int64_t)k < l ? a + (int64_t)k : l;
+					break;
+				}
+			for (uint64_t k = 0; k < range->n && b - (int64_t)k >= a; k++)
+				if (range->data[(b - k - range->start) % range->n]){
+					r = b - (int64_t)k > r ? b - (int64_t)k : r;
+					break;
+				}
+		}
+	}
+	if (l > r)
+		return false;
+	*left = l;
+	*right = r;
+	return true;
+}
+
+/*
+ * Count non-blank cells in the blocks in use.
+ */
+uint64_t TMTape_count(TMTape* tape){
+	if (!tape->fast)
+		return tape->live;
+	int64_t lo = -tape->bl * TM_BLOCK_SIZE, hi = tape->br * TM_BLOCK_SIZE;
+	uint64_t count = 0;
+	if (tape->bits == 1){
+		// The extent is a multiple of 16 cells, so only the
+		// edge words may be partially in use.
+		uint64_t *w = tape->cells;
+		for (int64_t i = lo >> 6; i <= (hi - 1) >> 6 && lo < hi; i++){
+			uint64_t word = w[i];
+			if (i == lo >> 6)
+				word &= ~0ull << (lo & 63);
+			if (i == (hi - 1) >> 6)
+				word &= ~0ull >> (63 - ((hi - 1) & 63));
+			count += __builtin_popcountll(word);
+		}
+		return count;
+	}
+	for (int64_t i = lo; i < hi; i++)
+		count += TMTape_get(tape, i) != 0;
+	return count;
+}
+
 /*
  * Returns state.
  */
 uint64_t TM_step(TM* machine, TMTape* tape){
 	if (!tape->state || machine->ok[tape->state - 1])
 		return tape->state;
-	uint64_t sym = TMTape_read(tape);
-	uint64_t new = machine->a[(tape->state - 1) * machine->n + sym];
-	uint64_t right = machine->m[(tape->state - 1) * machine->n + sym];
-	tape->state = machine->s[(tape->state - 1) * machine->n + sym];
-	TMTape_write(tape, new);
-	TMTape_step(tape, right);
+	uint64_t e = TM_entry(machine, tape->state, TMTape_read(tape));
+	tape->state = TM_entry_state(machine, e);
+	TMTape_write(tape, TM_entry_symbol(machine, e));
+	TMTape_step(tape, TM_entry_motion(e));
 	return tape->state;
 }
 
+/*
+ * Run at most `max` steps (all of them if `limited` is not set)
+ * over a packed table with entries of type `ttype` and
+ * a tape with cells of type `ctype`.
+ */
+#define TM_RUN_PACKED(ttype, ctype, machine, tape, max, limited) do {      \
+	ttype *t = (machine)->t;                                                \
+	uint64_t n = (machine)->n,                                              \
+			 sshift = TM_SHIFT + (machine)->abits,                          \
+			 amask = (1ull << (machine)->abits) - 1;                        \
+	uint64_t e = TM_GO | (tape)->state << sshift;                           \
+	while ((e & TM_GO) && (!(limited) || ((max) && (max)--))){              \
+		ctype *cell = (ctype*)(tape)->cells + (tape)->pos;                  \
+		e = t[((e >> sshift) - 1) * n + *cell];                             \
+		*cell = (e >> TM_SHIFT) & amask;                                    \
+		TMTape_step((tape), e & TM_RIGHT);                                  \
+		(tape)->state = e >> sshift;                                        \
+	}                                                                       \
+} while (0)
+
+/*
+ * Same as above for a tape of one-bit cells.
+ */
+#define TM_RUN_BITS(ttype, machine, tape, max, limited) do {                \
+	ttype *t = (machine)->t;                                                \
+	uint64_t n = (machine)->n,                                              \
+			 sshift = TM_SHIFT + (machine)->abits;                          \
+	uint64_t e = TM_GO | (tape)->state << sshift;                           \
+	while ((e & TM_GO) && (!(limited) || ((max) && (max)--))){              \
+		uint64_t *word = (uint64_t*)(tape)->cells + ((tape)->pos >> 6),     \
+				 bit = (tape)->pos & 63;                                    \
+		e = t[((e >> sshift) - 1) * n + ((*word >> bit) & 1)];              \
+		*word = (*word & ~(1ull << bit)) | (((e >> TM_SHIFT) & 1) << bit);  \
+		TMTape_step((tape), e & TM_RIGHT);                                  \
+		(tape)->state = e >> sshift;                                        \
+	}                                                                       \
+} while (0)
+
+#define TM_RUN_CELLS(ttype, machine, tape, max, limited) do {               \
+	switch ((tape)->bits){                                                  \
+		case 1: TM_RUN_BITS(ttype, machine, tape, max, limited); break;     \
+		case 8: TM_RUN_PACKED(ttype, uint8_t, machine, tape, max, limited); break;   \
+		case 16: TM_RUN_PACKED(ttype, uint16_t, machine, tape, max, limited); break; \
+		case 32: TM_RUN_PACKED(ttype, uint32_t, machine, tape, max, limited); break; \
+		default: TM_RUN_PACKED(ttype, uint64_t, machine, tape, max, limited);        \
+	}                                                                       \
+} while (0)
+
 /*
  * Returns state (if finishes).
  */
 uint64_t TM_run(TM* machine, TMTape* tape){
-	while (tape->state && !machine->ok[tape->state - 1])
-		TM_step(machine, tape);
+	if (!tape->state || machine->ok[tape->state - 1])
+		return tape->state;
+	// Counters of a tape which is not fast are kept by TM_step.
+	if (!tape->fast){
+		while (TM_step(machine, tape) && !machine->ok[tape->state - 1]);
+		return tape->state;
+	}
+	uint64_t max = 0;
+	if (machine->width == 4)
+		TM_RUN_CELLS(uint32_t, machine, tape, max, false);
+	else
+		TM_RUN_CELLS(uint64_t, machine, tape, max, false);
 	return tape->state;
 }
 
 /*
- * Returns state after <= `max` steps.
+ * Returns state after <= `*max` steps, `*max` is decreased
+ * by the count of steps done.
  */
-uint64_t TM_run_restricted(TM* machine, TMTape* tape, uint64_t max){
-	while (max-- && tape->state && !machine->ok[tape->state - 1])
-		TM_step(machine, tape);
+uint64_t TM_run_restricted(TM* machine, TMTape* tape, uint64_t *max){
+	if (!tape->state || machine->ok[tape->state - 1])
+		return tape->state;
+	if (!tape->fast){
+		for (; *max && tape->state && !machine->ok[tape->state - 1]; (*max)--)
+			TM_step(machine, tape);
+		return tape->state;
+	}
+	if (machine->width == 4)
+		TM_RUN_CELLS(uint32_t, machine, tape, *max, true);
+	else
+		TM_RUN_CELLS(uint64_t, machine, tape, *max, true);
 	return tape->state;
 }
+
+/*
+ * Threaded interpreter over cells accessed with `GET` and `SET`.
+ * Called with `ops` set, it only returns its code addresses:
+ * move left, move right, move left and stop, move right and stop,
+ * sweep left, sweep right. Sweeps are self-loops (S x -> S y):
+ * the rest of the run of x is found with TMTape_scan, rewritten
+ * with TMTape_fill and crossed at once.
+ */
+#define TM_THREADED(name, GET, SET)                                             \
+uint64_t name(TMThreaded* program, TMTape* tape, uint64_t max, void ***ops){   \
+	static void *labels[] = { &&left, &&right, &&left_out, &&right_out,        \
+							  &&sweep_left, &&sweep_right };                    \
+	if (ops){                                                                   \
+		*ops = labels;                                                          \
+		return 0;                                                               \
+	}                                                                           \
+	uint64_t n = program->machine->n, remaining = max;                          \
+	int64_t pos = tape->pos,                                                    \
+			lo = -tape->bl * TM_BLOCK_SIZE,                                     \
+			hi = tape->br * TM_BLOCK_SIZE - 1;                                  \
+	void *cells = tape->cells;                                                  \
+	TMHandler *row = program->rows + tape->state * n, *h;                       \
+	if (!remaining)                                                             \
+		return 0;                                                               \
+	h = row + GET(pos);                                                         \
+	SET(pos, h->sym);                                                           \
+	goto *h->op;                                                                \
+left:                                                                           \
+	if (pos == lo){                                                             \
+		TMTape_alloc(tape, false);                                              \
+		cells = tape->cells;                                                    \
+		lo -= TM_BLOCK_SIZE;                                                    \
+	}                                                                           \
+	pos--;                                                                      \
+	row = h->next;                                                              \
+	if (!--remaining)                                                           \
+		goto out;                                                               \
+	h = row + GET(pos);                                                         \
+	SET(pos, h->sym);                                                           \
+	goto *h->op;                                                                \
+right:                                                                          \
+	if (pos == hi){                                                             \
+		TMTape_alloc(tape, true);                                               \
+		cells = tape->cells;                                                    \
+		hi += TM_BLOCK_SIZE;                                                    \
+	}                                                                           \
+	pos++;                                                                      \
+	row = h->next;                                                              \
+	if (!--remaining)                                                           \
+		goto out;                                                               \
+	h = row + GET(pos);                                                         \
+	SET(pos, h->sym);                                                           \
+	goto *h->op;                                                                \
+sweep_left:                                                                     \
+	if (pos == lo || GET(pos - 1) != (uint64_t)(h - row))                       \
+		goto left;                                                              \
+	{                                                                           \
+		uint64_t k = pos - TMTape_scan(tape, pos - 1, false, h - row);          \
+		if (k > remaining)                                                      \
+			k = remaining;                                                      \
+		if (h->sym != (uint64_t)(h - row))                                      \
+			TMTape_fill(tape, pos - (k - 1), k - 1, h->sym);                    \
+		pos -= k - 1;                                                           \
+		remaining -= k - 1;                                                     \
+	}                                                                           \
+	goto left;                                                                  \
+sweep_right:                                                                    \
+	if (pos == hi || GET(pos + 1) != (uint64_t)(h - row))                       \
+		goto right;                                                             \
+	{                                                                           \
+		uint64_t k = TMTape_scan(tape, pos + 1, true, h - row) - pos;           \
+		if (k > remaining)                                                      \
+			k = remaining;                                                      \
+		if (h->sym != (uint64_t)(h - row))                                      \
+			TMTape_fill(tape, pos + 1, k - 1, h->sym);                          \
+		pos += k - 1;                                                           \
+		remaining -= k - 1;                                                     \
+	}                                                                           \
+	goto right;                                                                 \
+left_out:                                                                       \
+	if (pos == lo)                                                              \
+		TMTape_alloc(tape, false);                                              \
+	pos--;                                                                      \
+	remaining--;                                                                \
+	tape->state = h->state;                                                     \
+	tape->pos = pos;                                                            \
+	return max - remaining;                                                     \
+right_out:                                                                      \
+	if (pos == hi)                                                              \
+		TMTape_alloc(tape, true);                                               \
+	pos++;                                                                      \
+	remaining--;                                                                \
+	tape->state = h->state;                                                     \
+	tape->pos = pos;                                                            \
+	return max - remaining;                                                     \
+out:                                                                            \
+	tape->state = (row - program->rows) / n;                                    \
+	tape->pos = pos;                                                            \
+	return max;                                                                 \
+}
+
+#define TM_GET_BIT(pos) ((((uint64_t*)cells)[(pos) >> 6] >> ((pos) & 63)) & 1)
+#define TM_SET_BIT(pos, sym) (((uint64_t*)cells)[(pos) >> 6] =                 \
+	(((uint64_t*)cells)[(pos) >> 6] & ~(1ull << ((pos) & 63))) | ((sym) << ((pos) & 63)))
+#define TM_GET_8(pos) (((uint8_t*)cells)[pos])
+#define TM_SET_8(pos, sym) (((uint8_t*)cells)[pos] = (sym))
+#define TM_GET_16(pos) (((uint16_t*)cells)[pos])
+#define TM_SET_16(pos, sym) (((uint16_t*)cells)[pos] = (sym))
+#define TM_GET_32(pos) (((uint32_t*)cells)[pos])
+#define TM_SET_32(pos, sym) (((uint32_t*)cells)[pos] = (sym))
+#define TM_GET_64(pos) (((uint64_t*)cells)[pos])
+#define TM_SET_64(pos, sym) (((uint64_t*)cells)[pos] = (sym))
+
+TM_THREADED(TMThreaded_run_bits, TM_GET_BIT, TM_SET_BIT)
+TM_THREADED(TMThreaded_run_8, TM_GET_8, TM_SET_8)
+TM_THREADED(TMThreaded_run_16, TM_GET_16, TM_SET_16)
+TM_THREADED(TMThreaded_run_32, TM_GET_32, TM_SET_32)
+TM_THREADED(TMThreaded_run_64, TM_GET_64, TM_SET_64)
+
+typedef uint64_t (*TMThreadedRun)(TMThreaded*, TMTape*, uint64_t, void***);
+
+TMThreadedRun TMThreaded_select(uint8_t bits){
+	switch (bits){
+		case 1: return TMThreaded_run_bits;
+		case 8: return TMThreaded_run_8;
+		case 16: return TMThreaded_run_16;
+		case 32: return TMThreaded_run_32;
+		default: return TMThreaded_run_64;
+	}
+}
+
+/*
+ * Prepare a machine for tapes of the given cell width.
+ */
+TMThreaded* TMThreaded_init(TM* machine, uint8_t bits){
+	TMThreaded* program = NEWSTR(TMThreaded);
+	assert(program);
+	program->machine = machine;
+	program->bits = bits;
+	program->rows = NEWARR(TMHandler, machine->q * machine->n);
+	assert(program->rows);
+
+	void **ops;
+	TMThreaded_select(bits)(NULL, NULL, 0, &ops);
+	for (uint64_t s = 1; s < machine->q; s++)
+		for (uint64_t a = 0; a < machine->n; a++){
+			uint64_t e = TM_entry(machine, s, a);
+			TMHandler *h = program->rows + s * machine->n + a;
+			h->state = TM_entry_state(machine, e);
+			if (e & TM_GO)
+				h->op = ops[(h->state == s ? 4 : 0) + TM_entry_motion(e)];
+			else
+				h->op = ops[2 + TM_entry_motion(e)];
+			h->next = program->rows + h->state * machine->n;
+			h->sym = TM_entry_symbol(machine, e);
+		}
+	return program;
+}
+
+void TMThreaded_free(TMThreaded* program){
+	free(program->rows);
+	free(program);
+}
+
+/*
+ * Run at most `max` steps on a fast tape, return the count of steps done.
+ */
+uint64_t TMThreaded_run(TMThreaded* program, TMTape* tape, uint64_t max){
+	assert(tape->bits == program->bits && tape->fast);
+	if (!tape->state || program->machine->ok[tape->state - 1])
+		return 0;
+	return TMThreaded_select(program->bits)(program, tape, max, NULL);
+}
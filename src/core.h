@@ -13,8 +13,10 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 /*
  * A standard one-dimensional Turing machine.
@@ -22,17 +24,66 @@
  * TMTape structure.
  */
 typedef struct {
-	uint64_t n,  // size of alphabet (0 is blank and is counted)
-			 q;  // number of states (0 is undefined, 1 is the initial one)
-	bool *ok;    // final states (boolean, 0..q-1 (undefined state is omitted))
-	uint64_t *s; // transition table for states ([0<=i<=q-1, 0<=j<=n-1] = [i * n + j])
-	uint64_t *a; // transition table for symbols (same as above)
-	bool *m;     // transition table for motion (same as above)
+	uint64_t n,    // size of alphabet (0 is blank and is counted)
+			 q;    // number of states (0 is undefined, 1 is the initial one)
+	bool *ok;      // final states (boolean, 0..q-1 (undefined state is omitted))
+	uint8_t abits, // bits per symbol in a packed transition
+			width; // bytes per packed transition (4 or 8)
+	void *t;       // packed transition table ([0<=i<=q-1, 0<=j<=n-1] = [i * n + j])
+	bool shared;   // `t` is not owned (e.g. it is mapped from a file)
 } TM;
 
+/*
+ * A packed transition is a single 32- or 64-bit word:
+ *
+ *   MSB                                           LSB
+ *   +————————————————+———————————————+———————+————+
+ *   |   new state    |  new symbol   | right | go |
+ *   +————————————————+———————————————+———————+————+
+ *                     <—— abits ——>
+ *
+ * `go` is set if the new state is defined and not final,
+ * so a single load tells whether the machine keeps running.
+ * Undefined transitions are all-zero: they write blank,
+ * move left and go to the undefined state.
+ */
+#define TM_GO 1
+#define TM_RIGHT 2
+#define TM_SHIFT 2
+
+/*
+ * Get a packed transition (`s_from` shall be >0).
+ */
+static inline uint64_t TM_entry(TM* machine, uint64_t s_from, uint64_t a_from){
+	uint64_t i = (s_from - 1) * machine->n + a_from;
+	if (machine->width == 4)
+		return ((uint32_t*)machine->t)[i];
+	return ((uint64_t*)machine->t)[i];
+}
+
+/*
+ * Decode fields of a packed transition.
+ */
+static inline uint64_t TM_entry_state(TM* machine, uint64_t e){
+	return e >> (TM_SHIFT + machine->abits);
+}
+
+static inline uint64_t TM_entry_symbol(TM* machine, uint64_t e){
+	return (e >> TM_SHIFT) & ((1ull << machine->abits) - 1);
+}
+
+static inline bool TM_entry_motion(uint64_t e){
+	return e & TM_RIGHT;
+}
+
 TM* TM_init(uint64_t n, uint64_t q);
 void TM_free(TM*);
 
+/*
+ * Copy a machine.
+ */
+TM* TM_clone(TM*);
+
 /*
  * Define a transition table entry.
  */
@@ -43,6 +94,16 @@ void TM_define(TM*,
 			   uint64_t a_to,   // new symbol
 			   bool motion);    // motion direction (boolean, 1 is right)
 
+/*
+ * Mark a state as final.
+ */
+void TM_define_final(TM*, uint64_t s); // state, shall be >0
+
+/*
+ * Mark states as final (`n` states, each >0).
+ */
+void TM_define_finals(TM*, uint64_t n, uint64_t *s);
+
 /*
  * Define all transition table entries for a state.
  */
@@ -62,7 +123,7 @@ void TM_define_forall_readonly(TM*,
 							   bool motion); // motion direction (boolean, 1 is right)
 
 /*
- * Memory allocation is done block-by-block.
+ * Tape extent is tracked block-by-block.
  * This is the number of cells in a single block.
  * Shall be a power of 2.
  */
@@ -72,37 +133,186 @@ void TM_define_forall_readonly(TM*,
  * Shall be a power of 2.
  */
 #define TM_RENDER_BLOCK_SIZE 16
+/*
+ * Tape memory is a single buffer which grows geometrically
+ * in both directions. This is the initial capacity (in cells)
+ * of either side. Shall be a multiple of TM_BLOCK_SIZE.
+ */
+#define TM_TAPE_CAPACITY 1024
+/*
+ * Alignment of tape memory (in bytes). Buffers larger than
+ * TM_TAPE_HUGE_ALIGN are aligned to (and advised as) huge pages.
+ */
+#define TM_TAPE_ALIGN 64
+#define TM_TAPE_HUGE_ALIGN (1 << 21)
+/*
+ * Count of blocks kept between the head and an edge block
+ * before the latter may be trimmed (unless the tape is fast),
+ * so that a head moving to and fro around a block boundary
+ * does not take the same block into use over and over.
+ */
+#define TM_TAPE_SLACK 1
+/*
+ * Size (in bytes) of the segments of a tape file, in which
+ * its working set is counted. Shall be a multiple of the page size.
+ */
+#define TM_TAPE_SEGMENT (1 << 21)
+/*
+ * Default memory (in bytes) of a tape file kept around the head.
+ */
+#define TM_TAPE_MEMORY (256 << 20)
 
+/*
+ * A pattern repeated from `start` on (to the left of it for the
+ * left infinite one): cell `pos` holds `data[(pos - start) mod n]`.
+ * A finite one covers cells [`start`..`end`] only.
+ */
 typedef struct {
 	int64_t start;
 	uint64_t n;
 	uint64_t *data;
+	int64_t end;
 } TMTapePattern;
 
+/*
+ * Tape memory mapped from a sparse file (see TMTape_map).
+ */
+typedef struct {
+	int fd;
+	uint64_t hot;               // count of segments kept around the head
+	int64_t anchor;             // segment of the head when the others were paged out
+} TMTapeFile;
+
+/*
+ * A tape file starts with this header, the tape memory follows
+ * at offset TM_TAPE_SEGMENT (cell 0 being `lcap` cells into it).
+ * Cells outside of the blocks in use are undefined.
+ */
+#define TM_TAPE_MAGIC "TMT\x1a"
+typedef struct {
+	char magic[4];
+	uint32_t bits;
+	int64_t lcap, rcap, bl, br, pos;
+	uint64_t state;
+} TMTapeFileHeader;
+
 typedef struct {
-	uint64_t **bkmem,			// negative (<0) blocks of memory
-			 **fwmem;			// positive (>=0) blocks of memory
-	int64_t bl,					// count of negative blocks
-			br;					// count of positive blocks
+	void *mem,					// tape memory
+		 *cells;				// cell 0 (mem + lcap cells)
+	uint8_t bits;				// bits per cell (1, 8, 16, 32 or 64)
+	int64_t lcap,				// count of cells allocated to the left of cell 0
+			rcap;				// count of cells allocated from cell 0 onwards
+	int64_t bl,					// count of negative blocks in use
+			br;					// count of positive blocks in use
 	int64_t pos;				// current head position
 	uint64_t state;				// current machine state
 	bool fast;					// do not try to clear empty edge blocks
 	TMTapePattern left, right;  // infinite patterns to the left/right
+	TMTapePattern *ranges;      // finite patterns, disjoint and in order
+	uint64_t nr;
+	uint8_t *counts;            // count of cells differing from the patterns per block
+	                            // (block 0 at counts + lcap / TM_BLOCK_SIZE), unless fast
+	uint64_t live;              // count of non-blank cells in the blocks in use, unless fast
+	TMTapeFile *file;           // file the memory is mapped from (or NULL)
 } TMTape;
 
 /*
- *           block -1                block 0               block 1
- *                   bkmem<-|->fwmem
- * ~~  +—+—+—+—~  ~~  ~—+—+ | +—+—+—+—~  ~~  ~—+—+  +—+—+—+—~  ~~  ~—+—+  ~~
- * ~~  |0|0|0|0        0|0| | |0|0|0|0        0|0|  |0|0|0|0        0|0|  ~~
- * ~~  +—+—+—+—~  ~~  ~—+—+ | +—+—+—+—~  ~~  ~—+—+  +—+—+—+—~  ~~  ~—+—+  ~~
- *                    -2 -1 |  ^ 1 2 3              <——— BLOCK_SIZE ———>
- *                            pos          state=1
+ *        lcap                          rcap
+ *  <———————————————————>|<————————————————————————————————>
+ *  +—+—+—  ~~  —+—+—+—+—+—+—+—+—+—  ~~  —+—+—+—+—  ~~  —+—+
+ *  | | |        |0|0|0|0|0|0|0|0|        |0|0| |        | |
+ *  +—+—+—  ~~  —+—+—+—+—+—+—+—+—+—  ~~  —+—+—+—+—  ~~  —+—+
+ *  mem          <— bl —>|^ <——————— br ———————>
+ *                  cells pos          state=1
+ *
+ * Cells outside of the blocks in use are undefined and
+ * are filled from the patterns (if any) when the blocks
+ * are taken into use, so long finite patterns only take
+ * memory where the head has been.
+ *
+ * One-bit cells (binary alphabets) are packed into 64-bit
+ * words, cell `pos` being bit `pos & 63` of word `pos >> 6`.
+ *
+ * Unless the tape is fast, the cells of each block differing
+ * from the patterns are counted as they are written, and edge
+ * blocks where none do are trimmed at once when the head is
+ * TM_TAPE_SLACK blocks away from them.
+ */
+TMTape* TMTape_init(uint8_t bits, bool fast);
+
+/*
+ * Move tape memory into a file (created or truncated), mapped
+ * as a whole, and keep it there as the tape grows. Segments more
+ * than `memory` / 2 bytes away from the head are paged out from
+ * time to time (see TMTape_release), the kernel writing them back.
+ * The file holds the tape once it is freed.
+ * Return false if the file cannot be created.
  */
-TMTape* TMTape_init(bool fast);
+bool TMTape_map(TMTape*, char *path, uint64_t memory);
+
+/*
+ * Page the segments of a tape file far from the head out, once
+ * the head has moved away by half of the segments kept since the
+ * last time. Does nothing if the tape is not mapped from a file.
+ * Engines keep the head to themselves during runs, so it is called
+ * between them, while `pos` is current.
+ */
+void TMTape_release(TMTape*);
+
+/*
+ * Narrowest cell width (in bits) able to store
+ * symbols of an alphabet of the given size.
+ */
+uint8_t TMTape_bits(uint64_t n);
+
+/*
+ * Access a cell inside of the blocks in use. Writing this way
+ * leaves the counters as they are (see TMTape_recount).
+ */
+static inline uint64_t TMTape_get(TMTape* tape, int64_t pos){
+	switch (tape->bits){
+		case 1: return (((uint64_t*)tape->cells)[pos >> 6] >> (pos & 63)) & 1;
+		case 8: return ((uint8_t*)tape->cells)[pos];
+		case 16: return ((uint16_t*)tape->cells)[pos];
+		case 32: return ((uint32_t*)tape->cells)[pos];
+		default: return ((uint64_t*)tape->cells)[pos];
+	}
+}
+
+static inline void TMTape_set(TMTape* tape, int64_t pos, uint64_t sym){
+	switch (tape->bits){
+		case 1:
+			((uint64_t*)tape->cells)[pos >> 6] = 
+				(((uint64_t*)tape->cells)[pos >> 6] & ~(1ull << (pos & 63)))
+				| (sym << (pos & 63));
+			break;
+		case 8: ((uint8_t*)tape->cells)[pos] = sym; break;
+		case 16: ((uint16_t*)tape->cells)[pos] = sym; break;
+		case 32: ((uint32_t*)tape->cells)[pos] = sym; break;
+		default: ((uint64_t*)tape->cells)[pos] = sym;
+	}
+}
 void TMTape_prepare(TMTape*);
 void TMTape_free(TMTape*);
 
+/*
+ * Copy a tape (memory and patterns included).
+ */
+TMTape* TMTape_clone(TMTape*);
+
+/*
+ * Write the blocks in use, the head and the state to a file.
+ * Patterns are not saved (they come with the machine).
+ */
+bool TMTape_save(TMTape*, FILE*);
+
+/*
+ * Read a tape written by TMTape_save into a tape of the same width.
+ * Return false if the file is not such a tape, or if its head is
+ * outside of its blocks or its state is not below `q`.
+ */
+bool TMTape_load(TMTape*, FILE*, uint64_t q);
+
 /*
  * Write contents of tape to `mem` 
  * from positions [`pos`..`pos`+`n`-1].
@@ -116,6 +326,18 @@ void TMTape_readmem(TMTape*, int64_t pos, size_t n, uint64_t* mem);
  */
 void TMTape_writemem(TMTape*, int64_t pos, size_t n, uint64_t* mem);
 
+/*
+ * Count the cells of the blocks in use again, once they have been
+ * written with TMTape_set or directly (does nothing if fast).
+ */
+void TMTape_recount(TMTape*);
+
+/*
+ * Read a symbol outside of the blocks in use
+ * (blank or from the patterns).
+ */
+uint64_t TMTape_undefined(TMTape*, int64_t pos);
+
 /*
  * Read a symbol at the specified position.
  */
@@ -137,7 +359,8 @@ uint64_t TMTape_read(TMTape*);
 void TMTape_write(TMTape*, uint64_t sym);
 
 /*
- * Allocate a memory block in the given direction.
+ * Take a memory block into use in the given direction,
+ * growing the tape memory if needed.
  */
 void TMTape_alloc(TMTape*, bool right);
 
@@ -146,6 +369,31 @@ void TMTape_alloc(TMTape*, bool right);
  */
 void TMTape_step(TMTape*, bool right);
 
+/*
+ * Find the first cell from `pos` on (in the given direction)
+ * which is not `sym`. The scan stops at the edge of the blocks
+ * in use, returning the first position outside of them.
+ */
+int64_t TMTape_scan(TMTape*, int64_t pos, bool right, uint64_t sym);
+
+/*
+ * Write `sym` into cells [`pos`..`pos`+`n`-1] of the blocks in use.
+ */
+void TMTape_fill(TMTape*, int64_t pos, uint64_t n, uint64_t sym);
+
+/*
+ * Find the leftmost and rightmost non-blank cells of the blocks
+ * in use and of the finite patterns. Return false (leaving `left`
+ * and `right` as they are) if there are none.
+ */
+bool TMTape_span(TMTape*, int64_t *left, int64_t *right);
+
+/*
+ * Count non-blank cells in the blocks in use
+ * (O(1) unless the tape is fast).
+ */
+uint64_t TMTape_count(TMTape*);
+
 /*
  * Return state.
  */
@@ -157,6 +405,41 @@ uint64_t TM_step(TM*, TMTape*);
 uint64_t TM_run(TM*, TMTape*);
 
 /*
- * Return state after <= `max` steps.
+ * Return state after <= `*max` steps, `*max` is decreased
+ * by the count of steps done.
+ */
+uint64_t TM_run_restricted(TM*, TMTape*, uint64_t *max);
+
+/*
+ * A transition table prepared for the threaded interpreter:
+ * a row of `n` handlers per state, each holding the address
+ * of the code moving the head (and stopping, unless the new
+ * state keeps running), the symbol to write and the row of
+ * the new state, so that a step is a load, a store and
+ * a jump. Self-loops (S x -> S y) are classified when the
+ * rows are built and cross a whole run of x at once.
+ */
+typedef struct TMHandler {
+	void *op;               // code to continue with
+	struct TMHandler *next; // row of the new state
+	uint64_t sym,           // new symbol
+			 state;         // new state
+} TMHandler;
+
+typedef struct {
+	TM *machine;
+	uint8_t bits;           // cell width it has been prepared for
+	TMHandler *rows;        // [0<=i<=q-1, 0<=j<=n-1] = [i * n + j], row 0 is unused
+} TMThreaded;
+
+/*
+ * Prepare a machine for tapes of the given cell width.
+ */
+TMThreaded* TMThreaded_init(TM*, uint8_t bits);
+void TMThreaded_free(TMThreaded*);
+
+/*
+ * Run at most `max` steps on a fast tape.
+ * Return the count of steps done.
  */
-uint64_t TM_run_restricted(TM*, TMTape*, uint64_t max);
+uint64_t TMThreaded_run(TMThreaded*, TMTape*, uint64_t max);
@@ -0,0 +1,528 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "enumerate.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * A worker thread with its buffered records and statistics.
+ */
+typedef struct {
+	TMEnum *e;
+	unsigned id;
+	char *buffer;
+	size_t used;
+	TMEnumStats stats;
+	bool silent;    // drop the records (expanded before the split by another shard)
+} TMEnumWorker;
+
+TMEnum* TMEnum_init(uint64_t states, uint64_t symbols, uint64_t max, unsigned threads, FILE* out){
+	assert(states && states <= TM_ENUM_MAX_STATES);
+	assert(symbols >= 2 && symbols <= TM_ENUM_MAX_SYMBOLS);
+	assert(threads);
+	TMEnum* e = NEWSTR(TMEnum);
+	assert(e);
+	e->states = states;
+	e->symbols = symbols;
+	e->max = max;
+	e->threads = threads;
+	e->deques = calloc(threads, sizeof(TMEnumDeque));
+	assert(e->deques);
+	for (unsigned i = 0; i < threads; i++)
+		pthread_mutex_init(&e->deques[i].lock, NULL);
+	atomic_init(&e->pending, 0);
+	e->out = out;
+	pthread_mutex_init(&e->lock, NULL);
+	pthread_cond_init(&e->cond, NULL);
+	e->stats = (TMEnumStats){ 0 };
+	e->shard = 0;
+	e->shards = 1;
+	e->checkpoint = NULL;
+	e->interval = TM_ENUM_INTERVAL;
+	e->next = 0;
+	atomic_init(&e->pause, false);
+	e->running = e->paused = 0;
+	e->resumed = false;
+	return e;
+}
+
+void TMEnum_free(TMEnum* e){
+	for (unsigned i = 0; i < e->threads; i++){
+		pthread_mutex_destroy(&e->deques[i].lock);
+		free(e->deques[i].nodes);
+	}
+	free(e->deques);
+	pthread_mutex_destroy(&e->lock);
+	pthread_cond_destroy(&e->cond);
+	free(e);
+}
+
+size_t TMEnum_format(TMEnum* e, TM* machine, char* str){
+	size_t k = 0;
+	for (uint64_t s = 1; s <= e->states; s++){
+		if (s > 1)
+			str[k++] = '_';
+		for (uint64_t a = 0; a < e->symbols; a++){
+			uint64_t t = TM_entry(machine, s, a), to = TM_entry_state(machine, t);
+			if (to > e->states){
+				memcpy(str + k, "---", 3);
+			} else {
+				str[k] = '0' + TM_entry_symbol(machine, t);
+				str[k + 1] = TM_entry_motion(t) ? 'R' : 'L';
+				str[k + 2] = 'A' + to - 1;
+			}
+			k += 3;
+		}
+	}
+	str[k] = '\0';
+	return k;
+}
+
+void TMEnum_push(TMEnum* e, unsigned id, TMEnumNode* node){
+	TMEnumDeque *d = &e->deques[id];
+	atomic_fetch_add(&e->pending, 1);
+	pthread_mutex_lock(&d->lock);
+	if (d->bottom == d->size){
+		if (d->top > 0){
+			memmove(d->nodes, d->nodes + d->top, (d->bottom - d->top) * sizeof(TMEnumNode*));
+			d->bottom -= d->top;
+			d->top = 0;
+		}
+		if (d->bottom == d->size){
+			d->size = d->size ? 2 * d->size : 64;
+			d->nodes = realloc(d->nodes, d->size * sizeof(TMEnumNode*));
+			assert(d->nodes);
+		}
+	}
+	d->nodes[d->bottom++] = node;
+	pthread_mutex_unlock(&d->lock);
+}
+
+/*
+ * Take the most recent node of a deque (or, if `steal`, the oldest one).
+ */
+TMEnumNode* TMEnum_pop(TMEnumDeque* d, bool steal){
+	TMEnumNode *node = NULL;
+	pthread_mutex_lock(&d->lock);
+	if (d->top < d->bottom)
+		node = steal ? d->nodes[d->top++] : d->nodes[--d->bottom];
+	if (d->top == d->bottom)
+		d->top = d->bottom = 0;
+	pthread_mutex_unlock(&d->lock);
+	return node;
+}
+
+/*
+ * Write out the records of the worker and add up its statistics.
+ */
+void TMEnum_flush(TMEnumWorker* w){
+	TMEnum *e = w->e;
+	pthread_mutex_lock(&e->lock);
+	fwrite(w->buffer, 1, w->used, e->out);
+	e->stats.machines += w->stats.machines;
+	e->stats.halted += w->stats.halted;
+	e->stats.undecided += w->stats.undecided;
+	e->stats.steps = w->stats.steps > e->stats.steps ? w->stats.steps : e->stats.steps;
+	e->stats.ones = w->stats.ones > e->stats.ones ? w->stats.ones : e->stats.ones;
+	pthread_mutex_unlock(&e->lock);
+	w->used = 0;
+	w->stats = (TMEnumStats){ 0 };
+}
+
+/*
+ * Add a record to the buffer of the worker, writing it out when full.
+ */
+void TMEnum_record(TMEnumWorker* w, TM* machine, char status, uint64_t steps, uint64_t ones){
+	TMEnum *e = w->e;
+	if (w->silent)
+		return;
+	if (w->used + 4 * e->states * e->symbols + 64 > TM_ENUM_BUFFER)
+		TMEnum_flush(w);
+	w->used += TMEnum_format(e, machine, w->buffer + w->used);
+	if (status == TM_ENUM_HALTED)
+		w->used += sprintf(w->buffer + w->used, " %c %lu %lu\n", status, steps, ones);
+	else
+		w->used += sprintf(w->buffer + w->used, " %c\n", status);
+
+	w->stats.machines++;
+	if (status == TM_ENUM_HALTED){
+		w->stats.halted++;
+		w->stats.steps = steps > w->stats.steps ? steps : w->stats.steps;
+		w->stats.ones = ones > w->stats.ones ? ones : w->stats.ones;
+	} else
+		w->stats.undecided++;
+}
+
+void TMEnum_free_node(TMEnumNode* node){
+	TM_free(node->machine);
+	TMTape_free(node->tape);
+	free(node);
+}
+
+/*
+ * Run the machine of a node up to its next undefined transition,
+ * then list it as halting there and queue its extensions with the
+ * transition defined in every way allowed by Tree Normal Form.
+ */
+void TMEnum_expand(TMEnumWorker* w, TMEnumNode* node){
+	TMEnum *e = w->e;
+	TM *machine = node->machine;
+	TMTape *tape = node->tape;
+	uint64_t n = e->states, left = e->max - node->steps,
+			 state = TM_run_restricted(machine, tape, &left);
+	node->steps = e->max - left;
+	if (state <= n){
+		TMEnum_record(w, machine, TM_ENUM_UNDECIDED, node->steps, 0);
+		TMEnum_free_node(node);
+		return;
+	}
+
+	// Undo the move into the final state.
+	state -= n;
+	node->steps--;
+	TMTape_step(tape, false);
+	tape->state = state;
+	uint64_t sym = TMTape_read(tape);
+	TMEnum_record(w, machine, TM_ENUM_HALTED, node->steps + 1,
+				  TMTape_count(tape) - (sym != 0) + 1);
+
+	// Defining the last undefined transition leaves no way to halt.
+	if (node->defined + 1 < n * e->symbols){
+		uint64_t states = node->states < n ? node->states + 1 : n,
+				 symbols = node->symbols < e->symbols ? node->symbols + 1 : e->symbols;
+		for (uint64_t s = 1; s <= states; s++)
+			for (uint64_t a = 0; a < symbols; a++)
+				for (int right = 1; right >= 0; right--){
+					// Mirror images move left first; A0 -> A?R runs right forever.
+					if (!node->defined && (!right || s == 1))
+						continue;
+					TMEnumNode *child = NEWSTR(TMEnumNode);
+					assert(child);
+					child->machine = TM_clone(machine);
+					TM_define(child->machine, state, sym, s, a, right);
+					child->tape = TMTape_clone(tape);
+					child->steps = node->steps;
+					child->states = s > node->states ? s : node->states;
+					child->symbols = a + 1 > node->symbols ? a + 1 : node->symbols;
+					child->defined = node->defined + 1;
+					TMEnum_push(e, w->id, child);
+				}
+	}
+	TMEnum_free_node(node);
+}
+
+/*
+ * Root of the search tree: no transitions defined, a blank tape.
+ */
+TMEnumNode* TMEnum_root(TMEnum* e){
+	uint64_t n = e->states;
+	TMEnumNode *node = NEWSTR(TMEnumNode);
+	assert(node);
+	node->machine = TM_init(e->symbols, 2 * n);
+	for (uint64_t s = 1; s <= n; s++)
+		TM_define_final(node->machine, n + s);
+	for (uint64_t s = 1; s <= n; s++)
+		for (uint64_t a = 0; a < e->symbols; a++)
+			TM_define(node->machine, s, a, n + s, a, true);
+	node->tape = TMTape_init(TMTape_bits(e->symbols), true);
+	TMTape_prepare(node->tape);
+	node->steps = 0;
+	node->states = node->symbols = 1;
+	node->defined = 0;
+	return node;
+}
+
+/*
+ * Node of a machine read back from its record, to be run from
+ * a blank tape. Return NULL if the record is not a valid machine.
+ */
+TMEnumNode* TMEnum_parse(TMEnum* e, char* str){
+	uint64_t n = e->states, m = e->symbols;
+	TMEnumNode *node = TMEnum_root(e);
+	for (uint64_t s = 1; s <= n; s++)
+		for (uint64_t a = 0; a < m; a++, str += 3){
+			if (s > 1 && !a && *str++ != '_')
+				goto invalid;
+			if (!str[0] || !str[1])
+				goto invalid;
+			if (!strncmp(str, "---", 3))
+				continue;
+			uint64_t sym = str[0] - '0', to = str[2] - 'A' + 1;
+			if (sym >= m || (str[1] != 'L' && str[1] != 'R') || to < 1 || to > n)
+				goto invalid;
+			TM_define(node->machine, s, a, to, sym, str[1] == 'R');
+			node->states = to > node->states ? to : node->states;
+			node->symbols = sym + 1 > node->symbols ? sym + 1 : node->symbols;
+			node->defined++;
+		}
+	if (*str == '\0' || *str == '\n')
+		return node;
+invalid:
+	TMEnum_free_node(node);
+	return NULL;
+}
+
+/*
+ * Write the checkpoint (the workers being paused).
+ */
+void TMEnum_save(TMEnum* e){
+	size_t len = strlen(e->checkpoint);
+	char *tmp = NEWARR(char, len + 5), *str = NEWARR(char, 4 * e->states * e->symbols);
+	assert(tmp && str);
+	sprintf(tmp, "%s.tmp", e->checkpoint);
+	fflush(e->out);
+	fsync(fileno(e->out));
+	FILE *file = fopen(tmp, "w");
+	if (!file){
+		fprintf(stderr, "Could not open %s for writing.\n", tmp);
+		exit(1);
+	}
+	fprintf(file, "TMEnum %lu %lu %lu %lu %lu\n", e->states, e->symbols, e->max, e->shard, e->shards);
+	fprintf(file, "%ld %lu %lu %lu %lu %lu\n", ftell(e->out), e->stats.machines, e->stats.halted,
+			e->stats.undecided, e->stats.steps, e->stats.ones);
+	fprintf(file, "%lu\n", (uint64_t)atomic_load(&e->pending));
+	for (unsigned i = 0; i < e->threads; i++){
+		TMEnumDeque *d = &e->deques[i];
+		for (size_t j = d->top; j < d->bottom; j++){
+			TMEnum_format(e, d->nodes[j]->machine, str);
+			fprintf(file, "%s\n", str);
+		}
+	}
+	fflush(file);
+	fsync(fileno(file));
+	fclose(file);
+	if (rename(tmp, e->checkpoint)){
+		fprintf(stderr, "Could not write %s.\n", e->checkpoint);
+		exit(1);
+	}
+	free(tmp);
+	free(str);
+}
+
+bool TMEnum_load(TMEnum* e, uint64_t *length){
+	FILE *file = fopen(e->checkpoint, "r");
+	if (!file)
+		return false;
+	uint64_t states, symbols, max, shard, shards, count;
+	if (fscanf(file, "TMEnum %lu %lu %lu %lu %lu\n", &states, &symbols, &max, &shard, &shards) != 5
+		|| states != e->states || symbols != e->symbols || max != e->max
+		|| shard != e->shard || shards != e->shards){
+		fprintf(stderr, "Checkpoint %s is of another enumeration.\n", e->checkpoint);
+		exit(1);
+	}
+	if (fscanf(file, "%lu %lu %lu %lu %lu %lu\n%lu\n", length, &e->stats.machines,
+			   &e->stats.halted, &e->stats.undecided, &e->stats.steps, &e->stats.ones, &count) != 7){
+		fprintf(stderr, "Checkpoint %s is corrupted.\n", e->checkpoint);
+		exit(1);
+	}
+	size_t size = 4 * states * symbols + 2;
+	char *line = NEWARR(char, size);
+	assert(line);
+	for (uint64_t i = 0; i < count; i++){
+		TMEnumNode *node = fgets(line, size, file) ? TMEnum_parse(e, line) : NULL;
+		if (!node){
+			fprintf(stderr, "Checkpoint %s is corrupted.\n", e->checkpoint);
+			exit(1);
+		}
+		TMEnum_push(e, i % e->threads, node);
+	}
+	free(line);
+	fclose(file);
+	e->resumed = true;
+	return true;
+}
+
+/*
+ * Wait until the checkpoint is written.
+ */
+void TMEnum_wait(TMEnumWorker* w){
+	TMEnum *e = w->e;
+	TMEnum_flush(w);
+	pthread_mutex_lock(&e->lock);
+	e->paused++;
+	pthread_cond_broadcast(&e->cond);
+	while (atomic_load(&e->pause))
+		pthread_cond_wait(&e->cond, &e->lock);
+	e->paused--;
+	pthread_mutex_unlock(&e->lock);
+}
+
+/*
+ * Pause the other workers and write the checkpoint.
+ */
+void TMEnum_checkpoint(TMEnumWorker* w){
+	TMEnum *e = w->e;
+	TMEnum_flush(w);
+	pthread_mutex_lock(&e->lock);
+	while (e->paused + 1 < e->running)
+		pthread_cond_wait(&e->cond, &e->lock);
+	TMEnum_save(e);
+	e->next = time(NULL) + e->interval;
+	atomic_store(&e->pause, false);
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->lock);
+}
+
+void* TMEnum_work(void* arg){
+	TMEnumWorker *w = arg;
+	TMEnum *e = w->e;
+	for (;;){
+		if (atomic_load(&e->pause)){
+			TMEnum_wait(w);
+			continue;
+		}
+		if (e->checkpoint && (uint64_t)time(NULL) >= e->next && !atomic_exchange(&e->pause, true)){
+			TMEnum_checkpoint(w);
+			continue;
+		}
+		TMEnumNode *node = TMEnum_pop(&e->deques[w->id], false);
+		for (unsigned i = 1; !node && i < e->threads; i++)
+			node = TMEnum_pop(&e->deques[(w->id + i) % e->threads], true);
+		if (!node){
+			if (!atomic_load(&e->pending))
+				break;
+			sched_yield();
+			continue;
+		}
+		TMEnum_expand(w, node);
+		atomic_fetch_sub(&e->pending, 1);
+	}
+	TMEnum_flush(w);
+	pthread_mutex_lock(&e->lock);
+	e->running--;
+	pthread_cond_broadcast(&e->cond);
+	pthread_mutex_unlock(&e->lock);
+	return NULL;
+}
+
+/*
+ * Expand the search tree breadth first until it is wide enough
+ * to be split, then keep the nodes of this shard.
+ */
+void TMEnum_split(TMEnum* e){
+	TMEnumDeque *d = &e->deques[0];
+	TMEnumWorker w = { e, 0, NEWARR(char, TM_ENUM_BUFFER), 0, { 0 }, e->shard != 0 };
+	assert(w.buffer);
+	while (d->top < d->bottom && d->bottom - d->top < TM_ENUM_SPLIT * e->shards){
+		TMEnum_expand(&w, TMEnum_pop(d, true));
+		atomic_fetch_sub(&e->pending, 1);
+	}
+	TMEnum_flush(&w);
+	free(w.buffer);
+
+	size_t count = d->bottom - d->top;
+	TMEnumNode **nodes = NEWARR(TMEnumNode*, count + 1);
+	assert(nodes);
+	for (size_t i = 0; i < count; i++)
+		nodes[i] = TMEnum_pop(d, true);
+	for (size_t i = 0, k = 0; i < count; i++){
+		atomic_fetch_sub(&e->pending, 1);
+		if (i % e->shards == e->shard)
+			TMEnum_push(e, k++ % e->threads, nodes[i]);
+		else
+			TMEnum_free_node(nodes[i]);
+	}
+	free(nodes);
+}
+
+TMEnumStats TMEnum_run(TMEnum* e){
+	if (!e->resumed){
+		TMEnumNode *root = TMEnum_root(e);
+		TMEnum_push(e, 0, root);
+		if (e->shards > 1)
+			TMEnum_split(e);
+	}
+	e->next = time(NULL) + e->interval;
+
+	pthread_t *threads = NEWARR(pthread_t, e->threads);
+	TMEnumWorker *workers = NEWARR(TMEnumWorker, e->threads);
+	assert(threads && workers);
+	e->running = e->threads;
+	for (unsigned i = 0; i < e->threads; i++){
+		workers[i] = (TMEnumWorker){ e, i, NEWARR(char, TM_ENUM_BUFFER), 0, { 0 }, false };
+		assert(workers[i].buffer);
+		pthread_create(&threads[i], NULL, TMEnum_work, &workers[i]);
+	}
+	for (unsigned i = 0; i < e->threads; i++){
+		pthread_join(threads[i], NULL);
+		free(workers[i].buffer);
+	}
+	free(threads);
+	free(workers);
+	fflush(e->out);
+	if (e->checkpoint)
+		TMEnum_save(e);
+	return e->stats;
+}
+
+bool TMEnum_merge(char **paths, size_t n, FILE* out, TMEnumStats* stats){
+	uint64_t params[5] = { 0 }, *seen = NULL;
+	char *line = NULL;
+	size_t size = 0;
+	bool ok = true;
+	*stats = (TMEnumStats){ 0 };
+	for (size_t i = 0; ok && i < n; i++){
+		char *path = NEWARR(char, strlen(paths[i]) + 6);
+		assert(path);
+		sprintf(path, "%s.ckpt", paths[i]);
+		FILE *ckpt = fopen(path, "r"), *file = fopen(paths[i], "r");
+		uint64_t p[5], length, count = 1, dummy;
+		ok = ckpt && file
+			&& fscanf(ckpt, "TMEnum %lu %lu %lu %lu %lu\n", p, p + 1, p + 2, p + 3, p + 4) == 5
+			&& fscanf(ckpt, "%lu %lu %lu %lu %lu %lu\n%lu", &length, &dummy, &dummy,
+					  &dummy, &dummy, &dummy, &count) == 7 && !count;
+		if (!ok)
+			fprintf(stderr, "%s is not a finished enumeration.\n", paths[i]);
+		else if (!i){
+			memcpy(params, p, sizeof(params));
+			seen = calloc(p[4], sizeof(uint64_t));
+			assert(seen);
+		}
+		if (ok && (p[0] != params[0] || p[1] != params[1] || p[2] != params[2]
+				   || p[4] != params[4] || seen[p[3]]++)){
+			fprintf(stderr, "%s is not another shard of %s.\n", paths[i], paths[0]);
+			ok = false;
+		}
+		for (uint64_t read = 0; ok && read < length && getline(&line, &size, file) > 0; ){
+			read += strlen(line);
+			fputs(line, out);
+			uint64_t steps, ones;
+			char *fields = strchr(line, ' ');
+			stats->machines++;
+			if (fields && sscanf(fields, " H %lu %lu", &steps, &ones) == 2){
+				stats->halted++;
+				stats->steps = steps > stats->steps ? steps : stats->steps;
+				stats->ones = ones > stats->ones ? ones : stats->ones;
+			} else
+				stats->undecided++;
+		}
+		if (ckpt)
+			fclose(ckpt);
+		if (file)
+			fclose(file);
+		free(path);
+	}
+	for (uint64_t i = 0; ok && i < params[4]; i++)
+		if (!seen[i]){
+			fprintf(stderr, "Shard %lu of %lu is missing.\n", i, params[4]);
+			ok = false;
+		}
+	free(seen);
+	free(line);
+	return ok;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "core.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * Machines are printed with states as letters and symbols as digits.
+ */
+#define TM_ENUM_MAX_STATES 26
+#define TM_ENUM_MAX_SYMBOLS 10
+/*
+ * Default step limit of a machine.
+ */
+#define TM_ENUM_STEPS 1000000
+/*
+ * Bytes of records buffered by a worker before writing them out.
+ */
+#define TM_ENUM_BUFFER (1 << 16)
+/*
+ * Nodes per shard the search tree is expanded to (breadth first,
+ * on a single thread) before it is split into shards.
+ */
+#define TM_ENUM_SPLIT 64
+/*
+ * Default count of seconds between checkpoints.
+ */
+#define TM_ENUM_INTERVAL 60
+
+#define TM_ENUM_HALTED 'H'     // halted after `steps` steps leaving `ones` non-blank cells
+#define TM_ENUM_UNDECIDED 'U'  // still running after the step limit
+
+/*
+ * A node of the search tree: a machine in Tree Normal Form (its
+ * transitions are defined in the order they are first reached,
+ * new states and symbols in increasing order) run from a blank
+ * tape until an undefined transition or the step limit.
+ * Undefined transitions of state S lead to a final state n+S
+ * without changing the cell, so the run can be resumed.
+ */
+typedef struct {
+	TM *machine;
+	TMTape *tape;
+	uint64_t steps,     // steps done
+			 states,    // states used so far
+			 symbols,   // symbols used so far
+			 defined;   // transitions defined so far
+} TMEnumNode;
+
+/*
+ * Nodes of a worker: it takes the most recent ones (depth first),
+ * others steal the oldest ones (the largest subtrees).
+ */
+typedef struct {
+	TMEnumNode **nodes;
+	size_t top, bottom, size;  // nodes[top..bottom-1] are queued
+	pthread_mutex_t lock;
+} TMEnumDeque;
+
+/*
+ * Statistics of (a part of) the enumeration.
+ */
+typedef struct {
+	uint64_t machines, halted, undecided;
+	uint64_t steps, ones;  // most steps and non-blank cells among halted machines
+} TMEnumStats;
+
+/*
+ * Enumerator of all n-state m-symbol machines on a blank tape.
+ * Each machine reaching a halting (undefined) transition or
+ * the step limit is written to `out` as a line:
+ *     1RB1LB_1LA--- H 6 4
+ * (the transitions, `---` is undefined, the status and for halted
+ * machines the steps and non-blank cells including the halting
+ * transition, which writes 1). Machines which cannot halt (all
+ * transitions defined) are not listed, mirror images are pruned
+ * by moving right on the first transition.
+ *
+ * With `shards` > 1, the search tree is expanded to a fixed frontier
+ * whose nodes are dealt to the shards in turn, so that independent
+ * processes enumerate disjoint parts of the space (records of the
+ * nodes expanded before the split are listed by shard 0).
+ *
+ * With a `checkpoint` file, the workers are paused every `interval`
+ * seconds to save the frontier (the machines of the queued nodes),
+ * the statistics and the length of `out` there, which a new process
+ * resumes from (see TMEnum_load). The last checkpoint has no nodes.
+ */
+typedef struct {
+	uint64_t states, symbols, max;
+	unsigned threads;
+	TMEnumDeque *deques;
+	atomic_uint_fast64_t pending;  // nodes queued or being expanded
+	FILE *out;
+	pthread_mutex_t lock;          // of `out`, `stats` and the fields below
+	pthread_cond_t cond;
+	TMEnumStats stats;
+	uint64_t shard, shards;
+	char *checkpoint;
+	uint64_t interval, next;       // seconds between checkpoints, time of the next one
+	atomic_bool pause;             // workers shall wait for a checkpoint
+	unsigned running, paused;      // workers running, waiting
+	bool resumed;                  // the frontier has been loaded
+} TMEnum;
+
+TMEnum* TMEnum_init(uint64_t states, uint64_t symbols, uint64_t max, unsigned threads, FILE* out);
+void TMEnum_free(TMEnum*);
+
+/*
+ * Write a machine of the enumeration (without the final states).
+ * Return the count of characters written to `str`, which shall
+ * hold 4 * states * symbols characters.
+ */
+size_t TMEnum_format(TMEnum*, TM*, char* str);
+
+/*
+ * Load the frontier and the statistics from the checkpoint file
+ * of the enumerator, if any. Return false if there is none; exit
+ * with an error if it belongs to a different enumeration. The
+ * length of the output at the checkpoint is stored to `length`.
+ */
+bool TMEnum_load(TMEnum*, uint64_t *length);
+
+/*
+ * Run the enumeration on `threads` threads, return the statistics.
+ */
+TMEnumStats TMEnum_run(TMEnum*);
+
+/*
+ * Concatenate the outputs of the shards of an enumeration to `out`
+ * and sum up their statistics. Each output shall have a final
+ * checkpoint (its name with `.ckpt` appended) and every shard shall
+ * be given once. Return false (with a message) otherwise.
+ */
+bool TMEnum_merge(char **paths, size_t n, FILE* out, TMEnumStats* stats);
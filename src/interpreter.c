@@ -16,34 +16,104 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 TMDict* TMDict_init(){
 	TMDict* dict = NEWSTR(TMDict);
 	assert(dict);
-	dict->n = 0;
-	dict->tok = NULL;
+	*dict = (TMDict){ 0 };
 	return dict;
 }
 
 void TMDict_free(TMDict* dict){
-	for (uint64_t i = 0; i < dict->n; i++)
-		free(dict->tok[i]);
+	for (uint64_t i = 0; i < dict->nchunks; i++)
+		free(dict->chunks[i]);
+	free(dict->chunks);
+	free(dict->tok);
+	free(dict->slots);
 	free(dict);
 }
 
+static uint64_t TMDict_hash(char *str){
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (; *str; str++)
+		h = (h ^ (uint8_t)*str) * 0x100000001b3ull;
+	return h ^ (h >> 32);
+}
+
 /*
- * Put a token into the dict, 
+ * Rebuild the slots for at least `n` tokens.
+ */
+static void TMDict_index(TMDict* dict, uint64_t n){
+	uint64_t size = 16;
+	while (size < 2 * n)
+		size *= 2;
+	free(dict->slots);
+	dict->slots = calloc(size, sizeof(uint64_t));
+	assert(dict->slots);
+	dict->size = size;
+	for (uint64_t i = 0; i < dict->n; i++)
+		if (dict->tok[i]){
+			uint64_t h = TMDict_hash(dict->tok[i]) & (size - 1);
+			while (dict->slots[h])
+				h = (h + 1) & (size - 1);
+			dict->slots[h] = i + 1;
+		}
+}
+
+/*
+ * Slot holding the code of a token or, if it is not
+ * registered, the empty slot where it would go.
+ */
+static uint64_t* TMDict_slot(TMDict* dict, char *str){
+	if (!dict->slots)
+		TMDict_index(dict, dict->n + 1);
+	uint64_t h = TMDict_hash(str) & (dict->size - 1);
+	while (dict->slots[h] && strcmp(dict->tok[dict->slots[h] - 1], str) != 0)
+		h = (h + 1) & (dict->size - 1);
+	return dict->slots + h;
+}
+
+/*
+ * Copy a token into the chunks.
+ */
+static char* TMDict_intern(TMDict* dict, char *str){
+	size_t len = strlen(str) + 1;
+	if (dict->left < len){
+		size_t size = len > TM_DICT_CHUNK ? len : TM_DICT_CHUNK;
+		dict->chunks = realloc(dict->chunks, (dict->nchunks + 1) * sizeof(char*));
+		assert(dict->chunks);
+		dict->next = dict->chunks[dict->nchunks++] = NEWARR(char, size);
+		assert(dict->next);
+		dict->left = size;
+	}
+	char *copy = dict->next;
+	memcpy(copy, str, len);
+	dict->next += len;
+	dict->left -= len;
+	return copy;
+}
+
+/*
+ * Put a copy of a token into the dict, 
  * do nothing if it is already there.
  * Returns symbol/state code.
  */
 uint64_t TMDict_put(TMDict* dict, char *str){
-	for (uint64_t i = 0; i < dict->n; i++)
-		if (strcmp(dict->tok[i], str) == 0)
-			return i + 1;
-	dict->tok = realloc(dict->tok, (dict->n + 1) * sizeof(char*));
-	assert(dict->tok);
-	dict->tok[dict->n] = str;
-	return ++dict->n;
+	uint64_t *slot = TMDict_slot(dict, str);
+	if (*slot)
+		return *slot;
+	if (2 * (dict->n + 1) > dict->size){
+		TMDict_index(dict, dict->n + 1);
+		slot = TMDict_slot(dict, str);
+	}
+	if (dict->n == dict->cap){
+		dict->cap = dict->cap ? 2 * dict->cap : 16;
+		dict->tok = realloc(dict->tok, dict->cap * sizeof(char*));
+		assert(dict->tok);
+	}
+	dict->tok[dict->n] = TMDict_intern(dict, str);
+	return *slot = ++dict->n;
 }
 
 /*
@@ -53,10 +123,7 @@ uint64_t TMDict_put(TMDict* dict, char *str){
 uint64_t TMDict_get(TMDict* dict, char *str){
 	if (strcmp(str, "null") == 0)
 		return 0;
-	for (uint64_t i = 0; i < dict->n; i++)
-		if (strcmp(dict->tok[i], str) == 0)
-			return i + 1;
-	return 0;
+	return *TMDict_slot(dict, str);
 }
 
 /*
@@ -94,70 +161,84 @@ TMRuleToken TMRuleToken_init(char *str){
 	};
 }
 
-void TMProgram_parse_tape_file(TMProgram* program, FILE* file);
+/*
+ * Split a line in place into at most `max` whitespace-separated tokens,
+ * keeping the separators cut in `sep`. Returns the count of tokens.
+ */
+static int TMProgram_split(char *line, char **tok, char *sep, int max){
+	int k = 0;
+	while (k < max){
+		while (isspace(*line))
+			line++;
+		if (!*line)
+			break;
+		tok[k] = line;
+		while (*line && !isspace(*line))
+			line++;
+		sep[k++] = *line;
+		if (!*line)
+			break;
+		*line++ = '\0';
+	}
+	return k;
+}
+
+/*
+ * Put the separators cut by TMProgram_split back, for the line to be shown.
+ */
+static void TMProgram_unsplit(char **tok, char *sep, int k){
+	for (int i = 0; i < k; i++)
+		tok[i][strlen(tok[i])] = sep[i];
+}
 
 /*
  * Parse a program fron the specified file.
+ * Returns NULL (with a message) on failure.
  */
 TMProgram* TMProgram_parse(char *filename){
-	FILE* file = fopen(filename, "r");
-	assert(file);
-	
-	TMRuleToken start = {0, 0, NULL};
-	
-	TMRuleToken* final = NULL;
-	uint64_t fn = 0;
-	
-	TMRule* rules = NULL;
-	uint64_t n = 0;
+	TMText* text = TMText_open(filename);
+	if (!text){
+		fprintf(stderr, "Could not open %s.\n", filename);
+		return NULL;
+	}
+	TMProgram* prog = NEWSTR(TMProgram);
+	assert(prog);
+	*prog = (TMProgram){ 0 };
+	prog->text = text;
+	uint64_t cap = 0;
 
 	bool start_state_defined = false,
 		 final_states_defined = false;
 	
-	while (!feof(file)){
-		char *line = readline_trim(file);
-		if (strlen(line) == 0){
-			free(line);
+	for (char *line; (line = TMText_line(text)); ){
+		if (strlen(line) == 0)
 			continue;
-		}
-		if (strcmp(line, "=-=-=") == 0){
-			free(line);
+		if (strcmp(line, "=-=-=") == 0)
 			break;
-		}
 		if (!start_state_defined){
-			char *start_state = NEWARR(char, strlen(line));
-			assert(start_state);
-			if (sscanf(line, "[:] %s", start_state)){
+			char *start_state, sep;
+			if (strncmp(line, "[:]", 3) == 0 
+					&& TMProgram_split(line + 3, &start_state, &sep, 1)){
 				if (!check_name(start_state)){
 					fprintf(stderr,
 							"This name is invalid: %s\n"
 							"A correct name shall use only characters from "
 							"[A-Za-z0-9\\-_.~+-^<>[]{}()] and cannot be "
 							"equal to (null)\n", start_state);
-					free(start_state);
-					free(line);
-					fclose(file);
-					exit(1);
+					TMProgram_free(prog);
+					return NULL;
 				}
 				if (strcmp(start_state, "null") == 0){
 					fprintf(stderr, "Undefined state cannot be the starting one.\n");
-					free(start_state);
-					free(line);
-					fclose(file);
-					exit(1);
+					TMProgram_free(prog);
+					return NULL;
 				}
 				if (strcmp(start_state, "*") == 0 || strcmp(start_state, "_") == 0){
 					fprintf(stderr, "Wildcard state cannot be the starting one.\n");
-					free(start_state);
-					free(line);
-					fclose(file);
-					exit(1);
+					TMProgram_free(prog);
+					return NULL;
 				}
-				start.str = NEWARR(char, strlen(start_state) + 1);
-				assert(start.str);
-				strcpy(start.str, start_state);
-				start.any = false;
-				start.null = false;
+				prog->start_state = (TMRuleToken){ false, false, start_state };
 				start_state_defined = true;
 			} else
 				fprintf(stderr, "Definition of starting state shall be in form:\n"
@@ -165,7 +246,6 @@ TMProgram* TMProgram_parse(char *filename){
 								"Found:\n"
 								"%s\n"
 								"Skipping...\n", line);
-			free(start_state);
 		} else if (!final_states_defined){
 			if (strncmp(line, "[.]", 3) != 0){
 				fprintf(stderr, "Definition of final states shall be in form:\n"
@@ -173,180 +253,256 @@ TMProgram* TMProgram_parse(char *filename){
 								"Found:\n"
 								"%s\n"
 								"Skipping...\n", line);
-				free(line);
 				continue;
 			}
-			char *final_state = NEWARR(char, strlen(line));
-			assert(final_state);
-			for (char *state = strtok(line + 3, " \t"); 
-					state != NULL; 
-					state = strtok(NULL, " \t")){
-				strcpy(final_state, state);
-				if (strlen(final_state) == 0)
-					continue;
+			char *save;
+			for (char *final_state = strtok_r(line + 3, " \t", &save); 
+					final_state != NULL; 
+					final_state = strtok_r(NULL, " \t", &save)){
 				if (!check_name(final_state)){
 					fprintf(stderr, "This name is invalid: %s\n"
 									"A correct name shall use only characters from "
 									"[A-Za-z0-9\\-_.~+-^<>[]{}()] and cannot be "
 									"equal to (null)\n", final_state);
-					free(final_state);
-					free(line);
-					free(final);
-					fclose(file);
-					exit(1);
+					TMProgram_free(prog);
+					return NULL;
 				}
 				if (strcmp(final_state, "null") == 0){
 					fprintf(stderr, "Undefined state cannot be final.\n");
-					free(final_state);
-					free(line);
-					free(final);
-					fclose(file);
-					exit(1);
+					TMProgram_free(prog);
+					return NULL;
 				}
 				if (strcmp(final_state, "*") == 0 || strcmp(final_state, "_") == 0){
 					fprintf(stderr, "Wildcard state cannot be final.\n");
-					free(final_state);
-					free(line);
-					free(final);
-					fclose(file);
-					exit(1);
+					TMProgram_free(prog);
+					return NULL;
 				}
-				final = realloc(final, (fn + 1) * sizeof(TMRuleToken));
-				assert(final);
-				final[fn].str = NEWARR(char, strlen(final_state) + 1);
-				assert(final[fn].str);
-				strcpy(final[fn].str, final_state);
-				final[fn].any = false;
-				final[fn].null = false;
-				fn++;
+				prog->final_states = realloc(prog->final_states, (prog->fn + 1) * sizeof(TMRuleToken));
+				assert(prog->final_states);
+				prog->final_states[prog->fn++] = (TMRuleToken){ false, false, final_state };
 			}
-			free(final_state);
 			final_states_defined = true;
 		} else {
-			uint64_t l = strlen(line);
-			char *s_from_s = NEWARR(char, l),
-				 *a_from_s = NEWARR(char, l),
-				 *s_to_s = NEWARR(char, l),
-				 *a_to_s = NEWARR(char, l),
-				 *motion_s = NEWARR(char, l);
-			assert(s_from_s);
-			assert(a_from_s);
-			assert(s_to_s);
-			assert(a_to_s);
-			assert(motion_s);
-			if (sscanf(line, "%s %s -> %s %s %s", 
-						s_from_s, 
-						a_from_s, 
-						s_to_s, 
-						a_to_s, 
-						motion_s) == 5){
-				if (strcmp(s_to_s, "*") == 0 
-						|| strcmp(s_from_s, "null") == 0
-						|| (strcmp(s_from_s, "*") == 0 && strcmp(s_to_s, "_") == 0)
-						|| (strcmp(s_from_s, "_") == 0 && strcmp(s_to_s, "_") != 0)
-						|| strcmp(a_to_s, "*") == 0
-						|| (strcmp(a_from_s, "*") == 0 && strcmp(a_to_s, "_") == 0)
-						|| (strcmp(a_from_s, "_") == 0 && strcmp(a_to_s, "_") != 0)
-						|| (strcmp(motion_s, "l") != 0 && strcmp(motion_s, "r") != 0 
-								&& strcmp(motion_s, "<") != 0 && strcmp(motion_s, ">") != 0)){
-					fprintf(stderr, "Illegal rule:\n%s\n", line);
-					free(s_from_s);
-					free(a_from_s);
-					free(s_to_s);
-					free(a_to_s);
-					free(motion_s);
-					free(line);
-					free(final);
-					free(rules);
-					fclose(file);
-					exit(1);
-				}
-				if (!check_name(s_from_s) 
-						|| !check_name(s_to_s)){
-					fprintf(stderr, "Invalid name detected:\n%s\n"
-									"A correct name shall use only characters from "
-									"[A-Za-z0-9\\-_.~+-^<>[]{}()] and cannot be "
-									"equal to (null)\n", line);
-					free(s_from_s);
-					free(a_from_s);
-					free(s_to_s);
-					free(a_to_s);
-					free(motion_s);
-					free(line);
-					free(rules);
-					free(final);
-					fclose(file);
-					exit(1);
-				}
-				rules = realloc(rules, (n + 1) * sizeof(TMRule));
-				assert(rules);
-				rules[n].s_from = TMRuleToken_init(s_from_s);
-				rules[n].a_from = TMRuleToken_init(a_from_s);
-				rules[n].s_to = TMRuleToken_init(s_to_s);
-				rules[n].a_to = TMRuleToken_init(a_to_s);
-				rules[n].motion = strcmp(motion_s, "r") == 0 || strcmp(motion_s, ">") == 0;
-				n++;
-			} else {
-				if (strlen(line) > 0)
-					fprintf(stderr, "Definition of rules shall be in form:\n"
-									"q0 a0 -> q a [<|l|>|r|]\n"
-									"Found:\n"
-									"%s\n"
-									"Skipping...\n", line);
-				free(s_from_s);
-				free(a_from_s);
-				free(s_to_s);
-				free(a_to_s);
-				free(motion_s);
+			// <state> <char> -> <state> <char> <motion>, `->` possibly
+			// joined to the state after it.
+			char *tok[6], sep[6];
+			int k = TMProgram_split(line, tok, sep, 6);
+			char *t[5] = { tok[0], tok[1] };
+			bool form = k >= 3 && strncmp(tok[2], "->", 2) == 0;
+			if (form && tok[2][2] == '\0'){
+				form = k == 6;
+				t[2] = tok[3], t[3] = tok[4], t[4] = tok[5];
+			} else if (form){
+				form = k >= 5;
+				t[2] = tok[2] + 2, t[3] = tok[3], t[4] = tok[4];
+			}
+			if (!form){
+				TMProgram_unsplit(tok, sep, k);
+				fprintf(stderr, "Definition of rules shall be in form:\n"
+								"q0 a0 -> q a [<|l|>|r|]\n"
+								"Found:\n"
+								"%s\n"
+								"Skipping...\n", line);
+				continue;
+			}
+			char *s_from_s = t[0],
+				 *a_from_s = t[1],
+				 *s_to_s = t[2],
+				 *a_to_s = t[3],
+				 *motion_s = t[4];
+			if (strcmp(s_to_s, "*") == 0 
+					|| strcmp(s_from_s, "null") == 0
+					|| (strcmp(s_from_s, "*") == 0 && strcmp(s_to_s, "_") == 0)
+					|| (strcmp(s_from_s, "_") == 0 && strcmp(s_to_s, "_") != 0)
+					|| strcmp(a_to_s, "*") == 0
+					|| (strcmp(a_from_s, "*") == 0 && strcmp(a_to_s, "_") == 0)
+					|| (strcmp(a_from_s, "_") == 0 && strcmp(a_to_s, "_") != 0)
+					|| (strcmp(motion_s, "l") != 0 && strcmp(motion_s, "r") != 0 
+							&& strcmp(motion_s, "<") != 0 && strcmp(motion_s, ">") != 0)){
+				TMProgram_unsplit(tok, sep, k);
+				fprintf(stderr, "Illegal rule:\n%s\n", line);
+				TMProgram_free(prog);
+				return NULL;
+			}
+			if (!check_name(s_from_s) 
+					|| !check_name(s_to_s)){
+				TMProgram_unsplit(tok, sep, k);
+				fprintf(stderr, "Invalid name detected:\n%s\n"
+								"A correct name shall use only characters from "
+								"[A-Za-z0-9\\-_.~+-^<>[]{}()] and cannot be "
+								"equal to (null)\n", line);
+				TMProgram_free(prog);
+				return NULL;
+			}
+			if (prog->n == cap){
+				cap = cap ? 2 * cap : 16;
+				prog->rules = realloc(prog->rules, cap * sizeof(TMRule));
+				assert(prog->rules);
 			}
+			TMRule* rule = &prog->rules[prog->n++];
+			rule->s_from = TMRuleToken_init(s_from_s);
+			rule->a_from = TMRuleToken_init(a_from_s);
+			rule->s_to = TMRuleToken_init(s_to_s);
+			rule->a_to = TMRuleToken_init(a_to_s);
+			rule->motion = strcmp(motion_s, "r") == 0 || strcmp(motion_s, ">") == 0;
 		}
-		free(line);
 	}
-	TMProgram* prog = NEWSTR(TMProgram);
-	assert(prog);
-	prog->n = n;
-	prog->rules = rules;
-	prog->start_state = start;
-	prog->fn = fn;
-	prog->final_states = final;
-	TMProgram_parse_tape_file(prog, file);
-	fclose(file);
+	if (!start_state_defined){
+		fprintf(stderr, "Starting state is not defined.\n");
+		TMProgram_free(prog);
+		return NULL;
+	}
+	if (!TMProgram_parse_tape_file(prog, text, NULL)){
+		TMProgram_free(prog);
+		return NULL;
+	}
 	return prog;
 }
 
 void TMProgram_free(TMProgram* program){
 	free(program->rules);
-	free(program->start_state.str);
-	for (uint64_t i = 0; i < program->fn; i++)
-		free(program->final_states[i].str);
 	free(program->final_states);
-	for (uint64_t i = 0; i < program->tn; i++){
-		for (uint64_t j = 0; j < program->entries[i].n; j++)
-			free(program->entries[i].data[j]);
-		free(program->entries[i].data);
-	}
 	free(program->entries);
+	free(program->syms);
+	if (program->symbols)
+		TMDict_free(program->symbols);
+	if (program->text)
+		TMText_close(program->text);
 	free(program);
 }
 
 /*
- * Parse tape data from the specified file.
+ * Parse tape data from the specified file, replacing the entries
+ * of the program. Returns false (with a message) on failure.
  */
-void TMProgram_parse_tape(TMProgram* program, char *filename){
-	FILE* file = fopen(filename, "r");
-	assert(file);
-	TMProgram_parse_tape_file(program, file);
-	fclose(file);
+bool TMProgram_parse_tape(TMProgram* program, char *filename){
+	TMText* text = TMText_open(filename);
+	if (!text){
+		fprintf(stderr, "Could not open %s.\n", filename);
+		return false;
+	}
+	bool ok = TMProgram_parse_tape_file(program, text, NULL);
+	TMText_close(text);
+	return ok;
+}
+
+/*
+ * Boundary of the range of a parsed entry: it starts covering
+ * cells at `pos` or, if not `start`, stops covering them there.
+ */
+typedef struct {
+	int64_t pos;
+	uint64_t i;
+	bool start;
+} TMProgramBound;
+
+static int TMProgramBound_cmp(const void *a, const void *b){
+	int64_t x = ((TMProgramBound*)a)->pos, y = ((TMProgramBound*)b)->pos;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Max-heap of the indices of the entries covering a cell.
+ */
+static void TMProgram_heap_push(uint64_t *heap, uint64_t *n, uint64_t i){
+	uint64_t k = (*n)++;
+	for (; k && heap[(k - 1) / 2] < i; k = (k - 1) / 2)
+		heap[k] = heap[(k - 1) / 2];
+	heap[k] = i;
+}
+
+static void TMProgram_heap_pop(uint64_t *heap, uint64_t *n){
+	uint64_t i = heap[--*n], k = 0;
+	for (uint64_t c; (c = 2 * k + 1) < *n; k = c){
+		if (c + 1 < *n && heap[c + 1] > heap[c])
+			c++;
+		if (heap[c] <= i)
+			break;
+		heap[k] = heap[c];
+	}
+	heap[k] = i;
+}
+
+/*
+ * Split the ranges of the parsed entries (latter ones overwriting
+ * former ones) into disjoint entries, in order: a sweep over their
+ * bounds keeps the entries covering the current cell in a heap, the
+ * last of them owning it. `data` of the parsed entries are offsets
+ * into `syms`. Returns the count of entries written to `out`, which
+ * shall have room for 2 * `n` of them.
+ */
+static uint64_t TMProgram_resolve(TMProgramTapeEntry* parsed, uint64_t n, uint64_t *syms,
+								  TMProgramTapeEntry* out){
+	TMProgramBound* bounds = NEWARR(TMProgramBound, 2 * n + 1);
+	uint64_t *heap = NEWARR(uint64_t, n + 1);
+	bool *gone = zalloc2(n + 1);
+	assert(bounds && heap);
+	uint64_t nb = 0, nh = 0, count = 0;
+	for (uint64_t i = 0; i < n; i++){
+		if (parsed[i].end < parsed[i].pos && !parsed[i].l_inf && !parsed[i].r_inf)
+			continue;
+		bounds[nb++] = (TMProgramBound){ parsed[i].l_inf ? INT64_MIN : parsed[i].pos, i, true };
+		if (!parsed[i].r_inf)
+			bounds[nb++] = (TMProgramBound){ parsed[i].end + 1, i, false };
+	}
+	qsort(bounds, nb, sizeof(TMProgramBound), TMProgramBound_cmp);
+	const uint64_t none = UINT64_MAX;
+	uint64_t owner = none;
+	int64_t from = 0;
+	for (uint64_t b = 0; b <= nb; ){
+		int64_t pos = b < nb ? bounds[b].pos : INT64_MAX;
+		for (; b < nb && bounds[b].pos == pos; b++)
+			if (bounds[b].start)
+				TMProgram_heap_push(heap, &nh, bounds[b].i);
+			else
+				gone[bounds[b].i] = true;
+		while (nh && gone[heap[0]])
+			TMProgram_heap_pop(heap, &nh);
+		uint64_t now = nh ? heap[0] : none;
+		// The last owner (if any) covers cells up to infinity.
+		if (pos == INT64_MAX)
+			now = none, b++;
+		if (now == owner)
+			continue;
+		if (owner != none){
+			TMProgramTapeEntry* that = &parsed[owner];
+			// Position of the first symbol of the data.
+			int64_t origin = that->l_inf ? that->end + 1 : that->pos;
+			TMProgramTapeEntry* entry = &out[count++];
+			entry->l_inf = from == INT64_MIN;
+			entry->r_inf = pos == INT64_MAX;
+			entry->pos = from;
+			entry->end = pos - 1;
+			entry->n = that->n;
+			entry->shift = modulo(entry->l_inf ? pos - origin : from - origin, that->n);
+			entry->data = syms + (uint64_t)that->data;
+		}
+		owner = now;
+		from = pos;
+	}
+	free(bounds);
+	free(heap);
+	free(gone);
+	return count;
 }
 
-void TMProgram_parse_tape_file(TMProgram* program, FILE* file){
-	list_t *entry_list = list_init();
+// Symbols are interned as they are read.
+bool TMProgram_parse_tape_file(TMProgram* program, TMText* text, bool *more){
+	if (!program->symbols)
+		program->symbols = TMDict_init();
+	TMProgramTapeEntry* parsed = NULL;
+	uint64_t *syms = NULL;
+	uint64_t n = 0, cap = 0, sn = 0, scap = 0;
 
-	while (!feof(file)){
-		char *line = readline_trim(file);
-		if (strlen(line) == 0){
-			free(line);
+	bool ok = true;
+	if (more)
+		*more = false;
+	for (char *line; ok && (line = TMText_line(text)); ){
+		if (strlen(line) == 0)
 			continue;
+		if (more && strcmp(line, "=-=-=") == 0){
+			*more = true;
+			break;
 		}
 		int64_t pos = 0, end = 0;
 		bool pattern, l_inf = false, r_inf = false;
@@ -358,9 +514,8 @@ void TMProgram_parse_tape_file(TMProgram* program, FILE* file){
 			if (end < pos){
 				fprintf(stderr, "Starting index cannot be larger than ending one.\n"
 								"Could not parse entry:\n%s\n", line);
-				free(line);
-				fclose(file);
-				exit(1);
+				ok = false;
+				break;
 			}
 		} else if (sscanf(line, "%ld~inf%c", &pos, &c) == 2 && c == ':'){
 			pattern = true;
@@ -376,146 +531,171 @@ void TMProgram_parse_tape_file(TMProgram* program, FILE* file){
 							"\t(one of [pos, end] may be inf)\n"
 							"Found:\n%s\n"
 							"Skipping...\n", line);
-			free(line);
-			fclose(file);
 			continue;
 		}
-		list_push(entry_list, NEWSTR(TMProgramTapeEntry));
-		TMProgramTapeEntry* entry = entry_list->tail->val;
-		assert(entry);
+		if (n == cap){
+			cap = cap ? 2 * cap : 16;
+			parsed = realloc(parsed, cap * sizeof(TMProgramTapeEntry));
+			assert(parsed);
+		}
+		TMProgramTapeEntry* entry = &parsed[n++];
 		entry->pos = pos;
-		entry->n = 0;
-		entry->data = NULL;
 		entry->l_inf = l_inf;
 		entry->r_inf = r_inf;
 		entry->shift = 0;
-		if (!pattern)
-			end = pos - 1;
-		char *ch = strtok(line, ":");
-		for (ch = strtok(NULL, " \t"); ch != NULL; ch = strtok(NULL, " \t")){
-			entry->data = realloc(entry->data, (entry->n + 1) * sizeof(char*));
-			assert(entry->data);
-			entry->data[entry->n] = NEWARR(char, strlen(ch) + 1);
-			assert(entry->data[entry->n]);
-			strcpy(entry->data[entry->n], ch);
-			entry->n++;
-			if (!pattern)
-				end++;
+		// Offset into `syms` until they stop growing.
+		entry->data = (uint64_t*)sn;
+		char *save;
+		char *ch = strtok_r(line, ":", &save);
+		while ((ch = strtok_r(NULL, " \t", &save)) != NULL){
+			if (sn == scap){
+				scap = scap ? 2 * scap : 1024;
+				syms = realloc(syms, scap * sizeof(uint64_t));
+				assert(syms);
+			}
+			syms[sn++] = TMDict_put(program->symbols, ch);
 		}
+		entry->n = sn - (uint64_t)entry->data;
 		if (pattern && entry->n == 0){
 			fprintf(stderr, "Empty patterns are not allowed.\n"
 							"Could not parse entry:\n"
 							"%s\n", line);
-			free(line);
-			fclose(file);
-			exit(1);
+			ok = false;
+			break;
 		}
-		entry->end = end;
-		free(line);
-		uint64_t i = 0;
-		for (list_node_t *node = entry_list->head; node->val != entry; i++, node = node->next){
-			TMProgramTapeEntry* that = node->val;
-			if (l_inf){
-				if (that->r_inf){
-					if (that->pos <= end){
-						that->shift = modulo(that->shift + end + 1 - that->pos, that->n);
-						that->pos = end + 1;
-					}
-				} else if (that->end <= end){
-					for (uint64_t j = 0; j < that->n; j++)
-						free(that->data[j]);
-					free(that->data);
-					list_del(entry_list, i);
-					i--;
-				} else if (that->l_inf){
-					if (that->end > end){
-						that->shift = modulo(that->shift + end + 1 - that->end - 1, that->n);
-						that->pos = end + 1;
-						that->l_inf = false;
-					}
-				} else if (that->pos <= end){
-					that->shift = modulo(that->shift + end + 1 - that->pos, that->n);
-					that->pos = end + 1;
-				}
-			} else if (r_inf){
-				if (that->l_inf){
-					if (that->end >= pos){
-						that->shift = modulo(that->shift + pos - 1 - that->end, that->n);
-						that->end = pos - 1;
-					}
-				} else if (that->pos >= pos){
-					for (uint64_t j = 0; j < that->n; j++)
-						free(that->data[j]);
-					free(that->data);
-					list_del(entry_list, i);
-					i--;
-				} else if (that->r_inf){
-					if (that->pos < pos){
-						that->end = pos - 1;
-						that->r_inf = false;
-					}
-				} else if (that->end >= pos){
-					if (that->l_inf)
-						that->shift = modulo(that->shift + pos - 1 - that->end, that->n);
-					that->end = pos - 1;
-				}
-			} else if (!that->l_inf && !that->r_inf){
-				if (that->end >= pos && that->end <= end){
-					if (that->pos < pos){
-						that->end = pos - 1;
-					} else {
-						for (uint64_t j = 0; j < that->n; j++)
-							free(that->data[j]);
-						free(that->data);
-						list_del(entry_list, i);
-						i--;
-					}
-				} else if (that->end > end){
-					if (that->pos <= end && that->pos >= pos){
-						that->shift = modulo(that->shift + end + 1 - that->pos, that->n);
-						that->pos = end + 1;
-					} else if (that->pos < pos){
-						TMProgramTapeEntry* cut = NEWSTR(TMProgramTapeEntry);
-						assert(cut);
-						cut->shift = modulo(that->shift + end + 1 - that->pos, that->n);
-						cut->pos = end + 1;
-						cut->end = that->end;
-						cut->n = that->n;
-						cut->l_inf = cut->r_inf = false;
-						cut->data = NEWARR(char*, that->n);
-						assert(cut->data);
-						for (uint64_t j = 0; j < that->n; j++){
-							cut->data[j] = NEWARR(char, sizeof(that->data[j]));
-							assert(cut->data[j]);
-							strcpy(cut->data[j], that->data[j]);
-						}
-						list_insert(entry_list, node, NEWSTR(TMProgramTapeEntry));
-						that->end = pos - 1;
-					}
-				}
+		entry->end = pattern ? end : pos + (int64_t)entry->n - 1;
+	}
+	if (!ok){
+		free(parsed);
+		free(syms);
+		// The next tape starts after the separator.
+		for (char *line; more && (line = TMText_line(text)); ){
+			if (strcmp(line, "=-=-=") == 0){
+				*more = true;
+				break;
 			}
 		}
+		return false;
 	}
-	program->tn = entry_list->n;
-	program->entries = NEWARR(TMProgramTapeEntry, entry_list->n);
+	// Entries of the machine file are replaced.
+	free(program->entries);
+	free(program->syms);
+	program->entries = NEWARR(TMProgramTapeEntry, 2 * n + 1);
 	assert(program->entries);
-	uint64_t i = 0;
-	for (list_node_t *node = entry_list->head; node; i++, node = node->next)
-		program->entries[i] = *(TMProgramTapeEntry*)node->val;
-	while (entry_list->n)
-		list_del(entry_list, 0);
-}
-
-char* strcln(char *s){
-	char *str = NEWARR(char, strlen(s) + 1);
-	assert(str);
-	strcpy(str, s);
-	return str;
+	program->tn = TMProgram_resolve(parsed, n, syms, program->entries);
+	program->syms = syms;
+	free(parsed);
+	return true;
 }
 
 void TMDict_put_copy_if_unique(TMDict* dict, TMRuleToken tok){
 	if (!tok.any && !tok.null)
-		TMDict_put(dict, strcln(tok.str));
+		TMDict_put(dict, tok.str);
+}
+
+/*
+ * Flags of the offsets into `syms` at which the data of the entries
+ * start, `sn` being set to the count of symbols they use. Disjoint
+ * entries split from one parsed entry share its data, so walking
+ * the data of flagged offsets only (clearing the flags) visits each
+ * symbol once.
+ */
+static bool* TMProgram_sources(TMProgram* program, uint64_t *sn){
+	*sn = 0;
+	for (uint64_t i = 0; i < program->tn; i++){
+		uint64_t end = program->entries[i].data - program->syms + program->entries[i].n;
+		*sn = end > *sn ? end : *sn;
+	}
+	bool *first = zalloc2(*sn + 1);
+	for (uint64_t i = 0; i < program->tn; i++)
+		first[program->entries[i].data - program->syms] = true;
+	return first;
+}
+
+/*
+ * Build a tape from the entries of a program over the given alphabet.
+ * Returns NULL (with a message) if a symbol is not in the alphabet.
+ */
+TMTape* TMProgram_tape(TMProgram* program, TMDict* chars, uint8_t bits, bool fast){
+	// Symbols of the program are looked up once; data of the entries
+	// is translated into `codes` at the same offsets, once per parsed entry.
+	uint64_t ns = program->symbols ? program->symbols->n : 0, sn;
+	bool *first = TMProgram_sources(program, &sn);
+	uint64_t *map = NEWARR(uint64_t, ns + 1),
+			 *codes = NEWARR(uint64_t, sn + 1);
+	assert(map && codes);
+	for (uint64_t k = 0; k <= ns; k++)
+		map[k] = UINT64_MAX;
+	for (uint64_t i = 0; i < program->tn; i++){
+		TMProgramTapeEntry* entry = &program->entries[i];
+		uint64_t offset = entry->data - program->syms;
+		if (!first[offset])
+			continue;
+		first[offset] = false;
+		for (uint64_t j = 0; j < entry->n; j++){
+			uint64_t k = entry->data[j];
+			if (map[k] == UINT64_MAX){
+				char *sym = TMDict_at(program->symbols, k);
+				map[k] = TMDict_get(chars, sym);
+				if (!map[k] && strcmp(sym, "null") != 0){
+					fprintf(stderr, "Unknown symbol: %s\n", sym);
+					free(first);
+					free(map);
+					free(codes);
+					return NULL;
+				}
+			}
+			codes[offset + j] = map[k];
+		}
+	}
+	free(first);
+	free(map);
+	TMTape* tape = TMTape_init(bits, fast);
+	
+	// Register patterns, if any: infinite ones and finite ones which
+	// repeat their data (taken into memory only where they are used).
+	for (uint64_t i = 0; i < program->tn; i++){
+		TMProgramTapeEntry* entry = &program->entries[i];
+		uint64_t *data = codes + (entry->data - program->syms);
+		TMTapePattern* pattern = entry->l_inf ? &tape->left : entry->r_inf ? &tape->right : NULL;
+		if (!pattern && (uint64_t)(entry->end - entry->pos) >= entry->n){
+			tape->ranges = realloc(tape->ranges, (tape->nr + 1) * sizeof(TMTapePattern));
+			assert(tape->ranges);
+			pattern = &tape->ranges[tape->nr++];
+			pattern->end = entry->end;
+		}
+		if (!pattern)
+			continue;
+		pattern->start = entry->l_inf ? entry->end + 1 : entry->pos;
+		pattern->n = entry->n;
+		pattern->data = NEWARR(uint64_t, entry->n);
+		assert(pattern->data);
+		for (uint64_t j = 0; j < entry->n; j++)
+			pattern->data[j] = data[(j + entry->shift) % entry->n];
+	}
+	// Now, since infinite patterns are registered, 
+	// we can write to tape. If it was not done earlier,
+	// allocated blocks would be zero-filled.
+	TMTape_prepare(tape);
+	uint64_t buffer[4096];
+	for (uint64_t i = 0; i < program->tn; i++){
+		TMProgramTapeEntry* entry = &program->entries[i];
+		if (entry->l_inf || entry->r_inf || (uint64_t)(entry->end - entry->pos) >= entry->n)
+			continue;
+		uint64_t *data = codes + (entry->data - program->syms), k = entry->shift;
+		for (int64_t j = entry->pos; j <= entry->end; ){
+			uint64_t m = entry->end - j + 1 < 4096 ? entry->end - j + 1 : 4096;
+			for (uint64_t c = 0; c < m; c++){
+				buffer[c] = data[k];
+				if (++k == entry->n)
+					k = 0;
+			}
+			TMTape_writemem(tape, j, m, buffer);
+			j += m;
+		}
+	}
+	free(codes);
+	return tape;
 }
 
 /*
@@ -539,224 +719,61 @@ TMExecutable* TMProgram_compile(TMProgram* program, bool fast){
 	for (uint64_t i = 0; i < program->fn; i++)
 		TMDict_put_copy_if_unique(states, program->final_states[i]);
 
-	for (uint64_t i = 0; i < program->tn; i++)
-		for (uint64_t j = 0; j < program->entries[i].n; j++)
-			TMDict_put(chars, strcln(program->entries[i].data[j]));
-
-	TM* machine = TM_init(chars->n + 1, states->n + 1);
-	TMTape* tape = TMTape_init(fast);
-	
-	// Register infinite patterns, if any.
-	for (uint64_t i = 0; i < program->tn; i++){
-		TMProgramTapeEntry* entry = &program->entries[i];
-		if (entry->l_inf){
-			tape->left.start = entry->end + 1;
-			tape->left.n = entry->n;
-			tape->left.data = NEWARR(uint64_t, entry->n);
-			assert(tape->left.data);
-			for (uint64_t j = 0; j < entry->n; j++)
-				tape->left.data[j] = TMDict_get(chars, entry->data[(j + entry->shift) % entry->n]);
-		} else if (entry->r_inf){
-			tape->right.start = entry->pos;
-			tape->right.n = entry->n;
-			tape->right.data = NEWARR(uint64_t, entry->n);
-			assert(tape->right.data);
-			for (uint64_t j = 0; j < entry->n; j++)
-				tape->right.data[j] = TMDict_get(chars, entry->data[(j + entry->shift) % entry->n]);
-		}
-	}
-	// Now, since infinite patterns are registered, 
-	// we can write to tape. If it was not done earlier,
-	// allocated blocks would be zero-filled.
-	TMTape_prepare(tape);
+	// Symbols of the tape, in the order they are first met.
+	uint64_t sn;
+	bool *seen = zalloc2(program->symbols ? program->symbols->n + 1 : 1),
+		 *first = TMProgram_sources(program, &sn);
 	for (uint64_t i = 0; i < program->tn; i++){
-		TMProgramTapeEntry* entry = &program->entries[i];
-		if (!entry->l_inf && !entry->r_inf) {
-			for (int64_t j = entry->pos; j <= entry->end; j++)
-				TMTape_write_at(tape, j, TMDict_get(chars, 
-							entry->data[(j - entry->pos + entry->shift) % entry->n]));
+		uint64_t offset = program->entries[i].data - program->syms;
+		if (!first[offset])
+			continue;
+		first[offset] = false;
+		for (uint64_t j = 0; j < program->entries[i].n; j++){
+			uint64_t k = program->entries[i].data[j];
+			if (!seen[k])
+				TMDict_put(chars, TMDict_at(program->symbols, k));
+			seen[k] = true;
 		}
 	}
+	free(seen);
+	free(first);
+
+	TM* machine = TM_init(chars->n + 1, states->n + 1);
+	TMTape* tape = TMProgram_tape(program, chars, TMTape_bits(machine->n), fast);
+	
 	// Mark final states as final.
+	uint64_t *final = NEWARR(uint64_t, program->fn), fn = 0;
+	assert(final || !program->fn);
 	for (uint64_t i = 0; i < program->fn; i++){
 		uint64_t id = TMDict_get(states, program->final_states[i].str);
 		if (id)
-			machine->ok[id - 1] = true;
+			final[fn++] = id;
 	}
-	// Register transition rules.
+	TM_define_finals(machine, fn, final);
+	free(final);
+	// Register transition rules. Tokens are resolved once per rule,
+	// wildcard states expand to all the states, wildcard symbols to
+	// whole rows:
+	//   _ x -> _ y    S x -> S y for all S
+	//   * x -> s y    S x -> s y for all S
+	//   s0 * -> s a   s0 x -> s a for all x
+	//   s0 _ -> s _   s0 x -> s x for all x
 	for (uint64_t i = 0; i < program->n; i++){
-		TMRuleToken s_from = program->rules[i].s_from,
-					 a_from = program->rules[i].a_from,
-					 s_to = program->rules[i].s_to,
-					 a_to = program->rules[i].a_to;
-		bool motion = program->rules[i].motion;
-		if (a_from.any){
-			if (a_to.any){
-				if (s_from.any){
-					if (s_to.any){
-						// _ _ -> _ _ [l|r|<|>]
-						for (uint64_t i = 0; i < states->n; i++)
-							TM_define_forall_readonly(machine, 
-													   i + 1, 
-													   i + 1, 
-													   motion);
-					} else {
-						// * _ -> s _ [l|r|<|>]
-						uint64_t s = TMDict_get(states, s_to.str);
-						for (uint64_t i = 0; i < states->n; i++)
-							TM_define_forall_readonly(machine, 
-													   i + 1, 
-													   s, 
-													   motion);
-					}
-				} else {
-					uint64_t s0 = TMDict_get(states, s_from.str);
-					if (s_to.any){
-						// s0 _ -> _ _ [l|r|<|>]
-						TM_define_forall_readonly(machine,
-												   s0,
-												   s0,
-												   motion);
-					} else {
-						// s0 _ -> s _ [l|r]
-						uint64_t s = TMDict_get(states, s_to.str);
-						TM_define_forall_readonly(machine,
-												   s0,
-												   s,
-												   motion);
-					}
-				}
-			} else {
-				uint64_t a = TMDict_get(chars, a_to.str);
-				if (s_from.any){
-					if (s_to.any){
-						// _ * -> _ a [l|r|<|>]
-						for (uint64_t i = 0; i < states->n; i++)
-							TM_define_forall(machine, 
-											  i + 1, 
-											  i + 1, 
-											  a,
-											  motion);
-					} else {
-						// * * -> s a [l|r|<|>]
-						uint64_t s = TMDict_get(states, s_to.str);
-						for (uint64_t i = 0; i < states->n; i++)
-							TM_define_forall(machine, 
-											  i + 1, 
-											  s, 
-											  a,
-											  motion);
-					}
-				} else {
-					uint64_t s0 = TMDict_get(states, s_from.str);
-					if (s_to.any){
-						// s0 * -> _ a [l|r|<|>]
-						TM_define_forall(machine,
-										  s0,
-										  s0,
-										  a,
-										  motion);
-					} else {
-						// s0 * -> s a [l|r|<|>]
-						uint64_t s = TMDict_get(states, s_to.str);
-						TM_define_forall(machine,
-										  s0,
-										  s,
-										  a,
-										  motion);
-					}
-				}
-			}
-		} else {
-			uint64_t a0 = TMDict_get(chars, a_from.str);
-			if (a_to.any){
-				if (s_from.any){
-					if (s_to.any){
-						// _ a0 -> _ _ [l|r|<|>]
-						for (uint64_t i = 0; i < states->n; i++)
-							TM_define(machine, 
-									   i + 1,
-									   a0,
-									   i + 1,
-									   a0,
-									   motion);
-					} else {
-						// * a0 -> s _ [l|r|<|>]
-						uint64_t s = TMDict_get(states, s_to.str);
-						for (uint64_t i = 0; i < states->n; i++)
-							TM_define(machine,
-									   i + 1,
-									   a0,
-									   s,
-									   a0,
-									   motion);
-					}
-				} else {
-					uint64_t s0 = TMDict_get(states, s_from.str);
-					if (s_to.any){
-						// s0 a0 -> _ _ [l|r|<|>]
-						TM_define(machine,
-								   s0,
-								   a0,
-								   s0,
-								   a0,
-								   motion);
-					} else {
-						// s0 a0 -> s _ [l|r|<|>]
-						uint64_t s = TMDict_get(states, s_to.str);
-						TM_define(machine,
-								   s0,
-								   a0,
-								   s,
-								   a0,
-								   motion);
-					}
-				}
-			} else {
-				uint64_t a = TMDict_get(chars, a_to.str);
-				if (s_from.any){
-					if (s_to.any){
-						// _ a0 -> _ a [l|r|<|>]
-						for (uint64_t i = 0; i < states->n; i++)
-							TM_define(machine,
-									   i + 1,
-									   a0,
-									   i + 1,
-									   a,
-									   motion);
-					} else {
-						// * a0 -> s a [l|r|<|>]
-						uint64_t s = TMDict_get(states, s_to.str);
-						for (uint64_t i = 0; i < states->n; i++)
-							TM_define(machine,
-									   i + 1,
-									   a0,
-									   s,
-									   a,
-									   motion);
-					}
-				} else {
-					uint64_t s0 = TMDict_get(states, s_from.str);
-					if (s_to.any){
-						// s0 a0 -> _ a [l|r|<|>]
-						TM_define(machine,
-								   s0,
-								   a0,
-								   s0,
-								   a,
-								   motion);
-					} else {
-						// s0 a0 -> s a [l|r|<|>]
-						uint64_t s = TMDict_get(states, s_to.str);
-						TM_define(machine,
-								   s0,
-								   a0,
-								   s,
-								   a,
-								   motion);
-					}
-				}
-			}
+		TMRule* rule = &program->rules[i];
+		uint64_t s0 = rule->s_from.any ? 0 : TMDict_get(states, rule->s_from.str),
+				 a0 = rule->a_from.any ? 0 : TMDict_get(chars, rule->a_from.str),
+				 s = rule->s_to.any ? 0 : TMDict_get(states, rule->s_to.str),
+				 a = rule->a_to.any ? 0 : TMDict_get(chars, rule->a_to.str),
+				 first = rule->s_from.any ? 1 : s0,
+				 last = rule->s_from.any ? states->n : s0;
+		for (uint64_t from = first; from <= last; from++){
+			uint64_t to = rule->s_to.any ? from : s;
+			if (!rule->a_from.any)
+				TM_define(machine, from, a0, to, rule->a_to.any ? a0 : a, rule->motion);
+			else if (rule->a_to.any)
+				TM_define_forall_readonly(machine, from, to, rule->motion);
+			else
+				TM_define_forall(machine, from, to, a, rule->motion);
 		}
 	}
 	TMExecutable* exec = NEWSTR(TMExecutable);
@@ -765,42 +782,37 @@ TMExecutable* TMProgram_compile(TMProgram* program, bool fast){
 	exec->tape = tape;
 	exec->states = states;
 	exec->chars = chars;
+	exec->map = NULL;
+	exec->size = 0;
 	return exec;
 }
 
-static bool frame = false;
-static bool all = false;
-
-/*
- * Whether a frame will be drawn.
- */
-void global_set_frame(bool frm){
-	frame = frm;
-}
-
-/*
- * Whether all the tape will be drawn.
- */
-void global_set_draw_all(bool a){
-	all = a;
+void TMExecutable_free(TMExecutable* exec){
+	TM_free(exec->machine);
+	TMTape_free(exec->tape);
+	TMDict_free(exec->states);
+	TMDict_free(exec->chars);
+	if (exec->map)
+		munmap(exec->map, exec->size);
+	free(exec);
 }
 
 /*
- * Pretty-print contents of tape to stdout.
+ * Pretty-print contents of tape to stdout: 3 blocks around
+ * the tracked one or, if `all` is set, all the non-blank cells.
  */
-void TMTape_print(TMTape* tape, TMDict* states, TMDict* chars, uint64_t i, int64_t block){
+void TMTape_print(TMTape* tape, TMDict* states, TMDict* chars, uint64_t i, int64_t block,
+				  bool frame, bool all){
 	// Default: print all the tape.
-	int64_t offset = -tape->bl * TM_BLOCK_SIZE;
-	uint64_t len = (tape->bl + tape->br) * TM_BLOCK_SIZE;
+	int64_t offset = 0, right = -1;
+	uint64_t len;
 	// Print only 3 blocks around the target one.
 	if (!all){
 		offset = (block - 1) * TM_RENDER_BLOCK_SIZE;
 		len = 3 * TM_RENDER_BLOCK_SIZE;
 	} else {
-		while (!TMTape_read_at(tape, offset))
-			offset++;
-		while (len > 0 && !TMTape_read_at(tape, offset + (int64_t)len - 1))
-			len--;
+		TMTape_span(tape, &offset, &right);
+		len = right - offset + 1;
 	}
 	printf("Step:   %14lu\n", i);
 	printf("State:  %14s\n", TMDict_at(states, tape->state));
@@ -885,11 +897,12 @@ void TM_print(TM* machine, TMDict* states, TMDict* chars){
 	for (uint64_t s = 1; s <= states->n; s++){
 		for (uint64_t c = 0; c <= chars->n; c++){
 			printf("%lu:%s %lu:%s -> ", s, TMDict_at(states, s), c, TMDict_at(chars, c));
-			printf("%lu:%s %lu:%s %s\n", machine->s[(s - 1) * machine->n + c],
-										 TMDict_at(states, machine->s[(s - 1) * machine->n + c]), 
-										 machine->a[(s - 1) * machine->n + c],
-										 TMDict_at(chars, machine->a[(s - 1) * machine->n + c]), 
-										 machine->m[(s - 1) * machine->n + c] ? ">" : "<");
+			uint64_t e = TM_entry(machine, s, c);
+			printf("%lu:%s %lu:%s %s\n", TM_entry_state(machine, e),
+										 TMDict_at(states, TM_entry_state(machine, e)),
+										 TM_entry_symbol(machine, e),
+										 TMDict_at(chars, TM_entry_symbol(machine, e)),
+										 TM_entry_motion(e) ? ">" : "<");
 
 		}
 		printf("\n");
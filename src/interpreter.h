@@ -14,21 +14,37 @@
 #pragma once
 
 #include "core.h"
+#include "util.h"
 
 /*
  * Maps printable tokens to symbol/state codes.
- * Getting a string value is O(1).
+ * Getting a string value is O(1), getting a code is O(1) on average:
+ * codes are kept in an open-addressing table indexed by the hash
+ * of the tokens (built on the first lookup), which are interned
+ * into chunks owned by the dict.
  */
 typedef struct {
-	uint64_t n;    // count of registered tokens
-	char **tok;    // registered tokens; index is symbol/state code + 1
+	uint64_t n;       // count of registered tokens
+	char **tok;       // registered tokens; index is symbol/state code + 1
+	uint64_t cap;     // capacity of `tok`
+	uint64_t *slots;  // codes by hash of their tokens (0 is empty)
+	uint64_t size;    // count of slots (a power of 2)
+	char **chunks;    // storage of the tokens
+	uint64_t nchunks;
+	char *next;       // free part of the last chunk
+	size_t left;      // its size
 } TMDict;
 
+/*
+ * Size of a chunk of interned tokens.
+ */
+#define TM_DICT_CHUNK 65536
+
 TMDict* TMDict_init();
 void TMDict_free(TMDict*);
 
 /*
- * Put a token into the dict, 
+ * Put a copy of a token into the dict, 
  * do nothing if it is already there.
  * Returns symbol/state code.
  */
@@ -105,11 +121,13 @@ typedef struct {
 	int64_t pos, end;
 	bool l_inf, r_inf;
 	uint64_t n, shift;
-	char **data;
+	uint64_t *data; // codes of the symbols in the program's `symbols`
 } TMProgramTapeEntry;
 
 /*
  * Everything that user provides to create a machine.
+ * Tokens of the rules point into the text of the machine file,
+ * symbols of the tape are interned into `symbols`.
  */
 typedef struct {
 	uint64_t n; // rules count
@@ -118,20 +136,34 @@ typedef struct {
 	uint64_t fn; // final states count
 	TMRuleToken* final_states;
 	uint64_t tn; // tape entries count
-	TMProgramTapeEntry* entries;
+	TMProgramTapeEntry* entries; // disjoint, in order
+	TMDict *symbols; // symbols of the tape entries
+	uint64_t *syms;  // data of the tape entries
+	TMText *text;    // machine file (or NULL)
 } TMProgram;
 
 /*
  * Parse a program fron the specified file.
+ * Returns NULL (with a message) on failure.
  */
 TMProgram* TMProgram_parse(char *filename);
 
 void TMProgram_free(TMProgram*);
 
 /*
- * Parse tape data from the specified file.
+ * Parse tape data from the specified file, replacing the entries
+ * of the program. Returns false (with a message) on failure.
  */
-void TMProgram_parse_tape(TMProgram*, char *filename);
+bool TMProgram_parse_tape(TMProgram*, char *filename);
+
+/*
+ * Parse tape entries up to the end of the file or, if `more` is not
+ * NULL, up to a `=-=-=` line, setting `more` if one is met (another
+ * tape, maybe empty, following it). Replaces the entries of the
+ * program. Returns false (with a message) on failure, the rest of
+ * a failed tape being skipped.
+ */
+bool TMProgram_parse_tape_file(TMProgram*, TMText*, bool *more);
 
 /*
  * A machine, a tape, some string representations of
@@ -142,30 +174,34 @@ typedef struct {
 	TMTape* tape;
 	TMDict* states;
 	TMDict* chars;
+	void *map;         // file the machine has been loaded from (or NULL)
+	size_t size;       // size of the mapping
 } TMExecutable;
 
 /*
- * Compile a parsed program.
+ * Build a tape from the entries of a program over the given alphabet.
+ * Returns NULL (with a message) if a symbol is not in the alphabet.
  */
-TMExecutable* TMProgram_compile(TMProgram*, bool fast);
+TMTape* TMProgram_tape(TMProgram*, TMDict* chars, uint8_t bits, bool fast);
 
 /*
- * Whether a frame will be drawn.
- */
-void global_set_frame(bool);
-/*
- * Whether all the tape will be drawn.
+ * Compile a parsed program.
  */
-void global_set_draw_all(bool);
+TMExecutable* TMProgram_compile(TMProgram*, bool fast);
+
+void TMExecutable_free(TMExecutable*);
 
 /*
- * Pretty-print contents of tape to stdout.
+ * Pretty-print contents of tape to stdout: 3 blocks around
+ * the tracked one or, if `all` is set, all the non-blank cells.
  */
 void TMTape_print(TMTape*,
 				TMDict* states,
 				TMDict* chars,
 				uint64_t i,
-				int64_t block);
+				int64_t block,
+				bool frame,
+				bool all);
 
 /*
  * Pretty-print Turing machine.
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "jit.h"
+#include "util.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+
+/*
+ * Register assignment of the generated code:
+ *  rbx - TMTape*
+ *  rbp - rightmost allocated position
+ *  r12 - cell 0
+ *  r13 - head position
+ *  r14 - steps left
+ *  r15 - leftmost allocated position
+ * rax, rcx are scratch, everything else is left alone.
+ */
+
+typedef struct {
+	uint8_t *code;
+	size_t n, size;
+} TMJitBuffer;
+
+static void put(TMJitBuffer* buf, uint8_t *bytes, size_t n){
+	assert(buf->n + n <= buf->size);
+	memcpy(buf->code + buf->n, bytes, n);
+	buf->n += n;
+}
+
+#define PUT(buf, ...) put(buf, (uint8_t[]){ __VA_ARGS__ }, sizeof((uint8_t[]){ __VA_ARGS__ }))
+
+static void put32(TMJitBuffer* buf, uint32_t x){
+	put(buf, (uint8_t*)&x, 4);
+}
+
+static void put64(TMJitBuffer* buf, uint64_t x){
+	put(buf, (uint8_t*)&x, 8);
+}
+
+/*
+ * Point the rel32 operand at `at` to `target`.
+ */
+static void patch(TMJitBuffer* buf, size_t at, size_t target){
+	int32_t rel = (int32_t)((int64_t)target - (int64_t)(at + 4));
+	memcpy(buf->code + at, &rel, 4);
+}
+
+/*
+ * Emit an instruction ending with a rel32 operand pointing to `target`
+ * (or to nowhere, if `target` is not known yet).
+ * Returns the operand offset.
+ */
+static size_t put_rel(TMJitBuffer* buf, uint8_t *op, size_t n, size_t target){
+	put(buf, op, n);
+	size_t at = buf->n;
+	put32(buf, 0);
+	if (target != SIZE_MAX)
+		patch(buf, at, target);
+	return at;
+}
+
+#define JMP(buf, target) put_rel(buf, (uint8_t[]){ 0xE9 }, 1, target)
+#define CALL(buf, target) put_rel(buf, (uint8_t[]){ 0xE8 }, 1, target)
+#define JE(buf, target) put_rel(buf, (uint8_t[]){ 0x0F, 0x84 }, 2, target)
+// lea rcx, [rip + rel32]
+#define LEA_RCX(buf, target) put_rel(buf, (uint8_t[]){ 0x48, 0x8D, 0x0D }, 3, target)
+
+/*
+ * Reserve an 8-aligned table of `n` absolute addresses, the code
+ * before it shall not fall through. Returns its offset.
+ */
+static size_t put_table(TMJitBuffer* buf, size_t n){
+	while (buf->n % 8)
+		PUT(buf, 0xCC);
+	size_t at = buf->n;
+	for (size_t i = 0; i < n; i++)
+		put64(buf, 0);
+	return at;
+}
+
+static void set_table(TMJitBuffer* buf, size_t table, size_t i, size_t target){
+	uint64_t address = (uint64_t)(uintptr_t)(buf->code + target);
+	memcpy(buf->code + table + i * 8, &address, 8);
+}
+
+// mov reg, [rbx + disp32] and back
+static void load(TMJitBuffer* buf, uint8_t reg, size_t disp){
+	PUT(buf, 0x48 | (reg >= 8) << 2, 0x8B, 0x83 | (reg & 7) << 3);
+	put32(buf, disp);
+}
+
+static void store(TMJitBuffer* buf, uint8_t reg, size_t disp){
+	PUT(buf, 0x48 | (reg >= 8) << 2, 0x89, 0x83 | (reg & 7) << 3);
+	put32(buf, disp);
+}
+
+#define RAX 0
+#define RBP 5
+#define R12 12
+#define R13 13
+#define R15 15
+
+/*
+ * Upper bound of the generated code size.
+ */
+static size_t code_size(TM* machine){
+	return 1024 + machine->q * (8 + 64 + machine->n * 64);
+}
+
+/*
+ * Compile a machine for tapes of the given cell width.
+ */
+TMJit* TMJit_compile(TM* machine, uint8_t bits){
+	if (bits != 1 && bits != 8 && bits != 16 && bits != 32)
+		return NULL;
+	TMJitBuffer buf = { 0 };
+	buf.size = code_size(machine);
+	buf.code = mmap(NULL, buf.size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf.code == MAP_FAILED)
+		return NULL;
+	uint8_t shift = __builtin_ctz(TM_BLOCK_SIZE);
+
+	// Entry: save registers, keep the stack aligned for calls.
+	PUT(&buf, 0x53,				// push rbx
+			  0x55,				// push rbp
+			  0x41, 0x54,		// push r12
+			  0x41, 0x55,		// push r13
+			  0x41, 0x56,		// push r14
+			  0x41, 0x57,		// push r15
+			  0x48, 0x83, 0xEC, 0x08,	// sub rsp, 8
+			  0x48, 0x89, 0xFB,	// mov rbx, rdi
+			  0x49, 0x89, 0xF6);	// mov r14, rsi
+	size_t call_reload = CALL(&buf, SIZE_MAX);
+	load(&buf, R13, offsetof(TMTape, pos));
+	load(&buf, RAX, offsetof(TMTape, state));
+	size_t lea_states = LEA_RCX(&buf, SIZE_MAX);
+	PUT(&buf, 0xFF, 0x24, 0xC1);	// jmp [rcx + rax * 8]
+	size_t states = put_table(&buf, machine->q);
+	patch(&buf, lea_states, states);
+
+	// Load cell 0 and the allocated edges.
+	size_t reload = buf.n;
+	patch(&buf, call_reload, reload);
+	load(&buf, R12, offsetof(TMTape, cells));
+	load(&buf, RBP, offsetof(TMTape, br));
+	PUT(&buf, 0x48, 0xC1, 0xE5, shift,	// shl rbp, shift
+			  0x48, 0x83, 0xED, 0x01);	// sub rbp, 1
+	load(&buf, R15, offsetof(TMTape, bl));
+	PUT(&buf, 0x49, 0xC1, 0xE7, shift,	// shl r15, shift
+			  0x49, 0xF7, 0xDF,			// neg r15
+			  0xC3);					// ret
+
+	// Allocate a block at the edge, then reload.
+	size_t grow[2];
+	for (int right = 0; right < 2; right++){
+		grow[right] = buf.n;
+		PUT(&buf, 0x48, 0x83, 0xEC, 0x08,	// sub rsp, 8
+				  0x48, 0x89, 0xDF,			// mov rdi, rbx
+				  0xBE, right, 0, 0, 0,		// mov esi, right
+				  0x48, 0xB8);				// mov rax, TMTape_alloc
+		put64(&buf, (uint64_t)(uintptr_t)&TMTape_alloc);
+		PUT(&buf, 0xFF, 0xD0,				// call rax
+				  0x48, 0x83, 0xC4, 0x08);	// add rsp, 8
+		JMP(&buf, reload);
+	}
+
+	// Exit with the state in rax.
+	size_t out = buf.n;
+	store(&buf, RAX, offsetof(TMTape, state));
+	size_t out_unchanged = buf.n;
+	store(&buf, R13, offsetof(TMTape, pos));
+	PUT(&buf, 0x4C, 0x89, 0xF0,				// mov rax, r14
+			  0x48, 0x83, 0xC4, 0x08,		// add rsp, 8
+			  0x41, 0x5F,					// pop r15
+			  0x41, 0x5E,					// pop r14
+			  0x41, 0x5D,					// pop r13
+			  0x41, 0x5C,					// pop r12
+			  0x5D,							// pop rbp
+			  0x5B,							// pop rbx
+			  0xC3);						// ret
+
+	size_t *label = NEWARR(size_t, machine->q);
+	size_t *fixup = NEWARR(size_t, machine->q * machine->n);
+	uint64_t *target = NEWARR(uint64_t, machine->q * machine->n);
+	assert(label && fixup && target);
+	size_t fixups = 0;
+	size_t *cases = NEWARR(size_t, machine->n);
+	assert(cases);
+
+	for (uint64_t s = 0; s < machine->q; s++){
+		label[s] = out_unchanged;
+		if (!s || machine->ok[s - 1])
+			continue;
+
+		// Out of steps: keep the state.
+		size_t budget = buf.n;
+		PUT(&buf, 0x45, 0x31, 0xF6,			// xor r14d, r14d
+				  0x48, 0xB8);				// mov rax, s
+		put64(&buf, s);
+		JMP(&buf, out);
+
+		label[s] = buf.n;
+		PUT(&buf, 0x49, 0x83, 0xEE, 0x01);	// sub r14, 1
+		PUT(&buf, 0x72, (uint8_t)(budget - (buf.n + 2)));	// jc budget
+		switch (bits){
+			case 1:
+				PUT(&buf, 0x4D, 0x0F, 0xA3, 0x2C, 0x24);	// bt [r12], r13
+				break;
+			case 8:
+				PUT(&buf, 0x43, 0x0F, 0xB6, 0x04, 0x2C);	// movzx eax, byte [r12 + r13]
+				break;
+			case 16:
+				PUT(&buf, 0x43, 0x0F, 0xB7, 0x04, 0x6C);	// movzx eax, word [r12 + r13 * 2]
+				break;
+			case 32:
+				PUT(&buf, 0x43, 0x8B, 0x04, 0xAC);			// mov eax, [r12 + r13 * 4]
+				break;
+		}
+
+		// Few symbols are compared, many are looked up.
+		size_t table = SIZE_MAX;
+		if (bits == 1)
+			cases[1] = put_rel(&buf, (uint8_t[]){ 0x0F, 0x82 }, 2, SIZE_MAX);	// jc
+		else if (machine->n <= 4){
+			for (uint64_t a = 1; a < machine->n; a++){
+				PUT(&buf, 0x83, 0xF8, a);	// cmp eax, a
+				cases[a] = JE(&buf, SIZE_MAX);
+			}
+		} else {
+			size_t lea = LEA_RCX(&buf, SIZE_MAX);
+			PUT(&buf, 0xFF, 0x24, 0xC1);	// jmp [rcx + rax * 8]
+			table = put_table(&buf, machine->n);
+			patch(&buf, lea, table);
+		}
+
+		for (uint64_t a = 0; a < machine->n; a++){
+			if (table != SIZE_MAX)
+				set_table(&buf, table, a, buf.n);
+			else if (a)
+				patch(&buf, cases[a], buf.n);
+
+			uint64_t e = TM_entry(machine, s, a),
+					 s_to = TM_entry_state(machine, e),
+					 a_to = TM_entry_symbol(machine, e);
+			if (a_to != a)
+				switch (bits){
+					case 1:
+						if (a_to)
+							PUT(&buf, 0x4D, 0x0F, 0xAB, 0x2C, 0x24);	// bts [r12], r13
+						else
+							PUT(&buf, 0x4D, 0x0F, 0xB3, 0x2C, 0x24);	// btr [r12], r13
+						break;
+					case 8:
+						PUT(&buf, 0x43, 0xC6, 0x04, 0x2C, a_to);	// mov byte [r12 + r13], a_to
+						break;
+					case 16:
+						PUT(&buf, 0x66, 0x43, 0xC7, 0x04, 0x6C,	// mov word [r12 + r13 * 2], a_to
+								  a_to & 0xFF, a_to >> 8);
+						break;
+					case 32:
+						PUT(&buf, 0x43, 0xC7, 0x04, 0xAC);		// mov dword [r12 + r13 * 4], a_to
+						put32(&buf, a_to);
+						break;
+				}
+			if (TM_entry_motion(e)){
+				PUT(&buf, 0x49, 0x39, 0xED,		// cmp r13, rbp
+						  0x75, 0x05);			// jne +5
+				CALL(&buf, grow[1]);
+				PUT(&buf, 0x49, 0xFF, 0xC5);	// inc r13
+			} else {
+				PUT(&buf, 0x4D, 0x39, 0xFD,		// cmp r13, r15
+						  0x75, 0x05);			// jne +5
+				CALL(&buf, grow[0]);
+				PUT(&buf, 0x49, 0xFF, 0xCD);	// dec r13
+			}
+			if (e & TM_GO){
+				fixup[fixups] = JMP(&buf, SIZE_MAX);
+				target[fixups++] = s_to;
+			} else {
+				PUT(&buf, 0x48, 0xB8);			// mov rax, s_to
+				put64(&buf, s_to);
+				JMP(&buf, out);
+			}
+		}
+	}
+	for (size_t i = 0; i < fixups; i++)
+		patch(&buf, fixup[i], label[target[i]]);
+	for (uint64_t s = 0; s < machine->q; s++)
+		set_table(&buf, states, s, label[s]);
+	free(label);
+	free(fixup);
+	free(target);
+	free(cases);
+
+	if (mprotect(buf.code, buf.size, PROT_READ | PROT_EXEC)){
+		munmap(buf.code, buf.size);
+		return NULL;
+	}
+	TMJit* jit = NEWSTR(TMJit);
+	assert(jit);
+	jit->code = buf.code;
+	jit->size = buf.size;
+	jit->bits = bits;
+	return jit;
+}
+
+void TMJit_free(TMJit* jit){
+	munmap(jit->code, jit->size);
+	free(jit);
+}
+
+/*
+ * Run at most `max` steps on a fast tape.
+ */
+uint64_t TMJit_run(TMJit* jit, TMTape* tape, uint64_t max){
+	assert(tape->bits == jit->bits && tape->fast);
+	uint64_t (*run)(TMTape*, uint64_t) = (uint64_t (*)(TMTape*, uint64_t))jit->code;
+	return max - run(tape, max);
+}
+
+#else
+
+TMJit* TMJit_compile(TM* machine, uint8_t bits){
+	return NULL;
+}
+
+void TMJit_free(TMJit* jit){
+}
+
+uint64_t TMJit_run(TMJit* jit, TMTape* tape, uint64_t max){
+	return 0;
+}
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "core.h"
+
+/*
+ * A transition table compiled into x86-64 machine code.
+ * Every state is a block of code dispatching on the current
+ * symbol, transitions are direct jumps between the blocks.
+ * The head position and the tape edges live in registers;
+ * the tape only grows through TMTape_alloc.
+ */
+typedef struct {
+	uint8_t *code;  // executable buffer
+	size_t size;    // its size in bytes
+	uint8_t bits;   // cell width it has been compiled for
+} TMJit;
+
+/*
+ * Compile a machine for tapes of the given cell width.
+ * Returns NULL if the machine (or the platform) is not supported:
+ * only x86-64 and 1-, 8-, 16- and 32-bit cells are.
+ */
+TMJit* TMJit_compile(TM*, uint8_t bits);
+void TMJit_free(TMJit*);
+
+/*
+ * Run at most `max` steps on a fast tape.
+ * Returns the count of steps done.
+ */
+uint64_t TMJit_run(TMJit*, TMTape*, uint64_t max);
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "lanes.h"
+#include "util.h"
+#include <stdlib.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define W TM_LANES_WINDOW
+
+TMLanes* TMLanes_init(TM* machine, uint8_t bits, uint64_t max){
+	TMLanes* lanes = NEWSTR(TMLanes);
+	assert(lanes);
+	lanes->machine = machine;
+	lanes->threaded = TMThreaded_init(machine, bits);
+	lanes->max = max;
+	lanes->cells = NEWARR(uint32_t, TM_LANES * W + 1);
+	assert(lanes->cells);
+	lanes->buffer = NEWARR(uint64_t, W);
+	assert(lanes->buffer);
+	for (int l = 0; l < TM_LANES; l++)
+		lanes->tape[l] = NULL;
+	return lanes;
+}
+
+void TMLanes_free(TMLanes* lanes){
+	TMThreaded_free(lanes->threaded);
+	free(lanes->cells);
+	free(lanes->buffer);
+	free(lanes);
+}
+
+/*
+ * Run a tape with the threaded interpreter until it halts or
+ * runs out of steps. Return the count of steps done in total.
+ */
+uint64_t TMLanes_finish(TMLanes* lanes, TMTape* tape, uint64_t steps){
+	while (tape->state && !lanes->machine->ok[tape->state - 1]
+		   && (!lanes->max || steps < lanes->max)){
+		uint64_t chunk = 10000000;
+		if (lanes->max && lanes->max - steps < chunk)
+			chunk = lanes->max - steps;
+		steps += TMThreaded_run(lanes->threaded, tape, chunk);
+	}
+	return steps;
+}
+
+/*
+ * Run the tapes one by one.
+ */
+void TMLanes_serial(TMLanes* lanes, TMLanesNext next, TMLanesDone done, void *arg){
+	uint64_t id;
+	for (TMTape* tape; (tape = next(arg, &id)); )
+		done(arg, id, tape, TMLanes_finish(lanes, tape, 0));
+}
+
+#if defined(__x86_64__)
+
+/*
+ * Give lane `l` as many steps as it may run without a check.
+ */
+void TMLanes_budget(TMLanes* lanes, int l){
+	uint64_t budget = TM_LANES_BUDGET;
+	if (lanes->max && lanes->max - lanes->steps[l] < budget)
+		budget = lanes->max - lanes->steps[l];
+	lanes->budget[l] = lanes->given[l] = budget;
+}
+
+/*
+ * Copy a tape into the window of lane `l`.
+ */
+void TMLanes_load(TMLanes* lanes, int l, TMTape* tape, uint64_t id){
+	assert(tape->pos >= -W / 2 && tape->pos < W / 2);
+	TMTape_readmem(tape, -W / 2, W, lanes->buffer);
+	uint32_t *cells = lanes->cells + l * W;
+	for (int i = 0; i < W; i++)
+		cells[i] = lanes->buffer[i];
+	lanes->tape[l] = tape;
+	lanes->id[l] = id;
+	lanes->steps[l] = 0;
+	lanes->state[l] = tape->state;
+	lanes->pos[l] = lanes->lo[l] = lanes->hi[l] = l * W + W / 2 + tape->pos;
+	TMLanes_budget(lanes, l);
+}
+
+/*
+ * Write the cells written by lane `l`, its head and state back to its tape.
+ */
+void TMLanes_store(TMLanes* lanes, int l){
+	TMTape* tape = lanes->tape[l];
+	int32_t origin = l * W + W / 2, n = lanes->hi[l] - lanes->lo[l] + 1;
+	for (int32_t i = 0; i < n; i++)
+		lanes->buffer[i] = lanes->cells[lanes->lo[l] + i];
+	TMTape_writemem(tape, lanes->lo[l] - origin, n, lanes->buffer);
+	tape->state = lanes->state[l];
+	tape->pos = lanes->pos[l] - origin;
+	// Keep the head inside of the blocks in use.
+	TMTape_write_at(tape, tape->pos, TMTape_read_at(tape, tape->pos));
+}
+
+/*
+ * Load the next tape which is not halted into lane `l`
+ * or, if there is none, leave the lane empty.
+ */
+void TMLanes_fill(TMLanes* lanes, int l, TMLanesNext next, TMLanesDone done, void *arg){
+	TMTape* tape;
+	uint64_t id;
+	while ((tape = next(arg, &id))){
+		if (tape->state && !lanes->machine->ok[tape->state - 1]){
+			TMLanes_load(lanes, l, tape, id);
+			return;
+		}
+		done(arg, id, tape, 0);
+	}
+	lanes->tape[l] = NULL;
+	lanes->state[l] = 0;
+	lanes->pos[l] = lanes->lo[l] = lanes->hi[l] = TM_LANES * W;
+	lanes->budget[l] = lanes->given[l] = 0;
+}
+
+/*
+ * Handle lane `l` which has stopped: its tape has halted, its head
+ * has left the window or its budget is spent.
+ */
+void TMLanes_stop(TMLanes* lanes, int l, TMLanesNext next, TMLanesDone done, void *arg){
+	lanes->steps[l] += lanes->given[l] - lanes->budget[l];
+	lanes->given[l] = lanes->budget[l];
+	uint64_t state = lanes->state[l];
+	bool halted = !state || lanes->machine->ok[state - 1],
+		 outside = lanes->pos[l] < l * W || lanes->pos[l] >= (l + 1) * W,
+		 limited = lanes->max && lanes->steps[l] == lanes->max;
+	if (!halted && !outside && !limited){
+		TMLanes_budget(lanes, l);
+		return;
+	}
+	TMLanes_store(lanes, l);
+	uint64_t steps = lanes->steps[l];
+	if (outside)
+		steps = TMLanes_finish(lanes, lanes->tape[l], steps);
+	done(arg, lanes->id[l], lanes->tape[l], steps);
+	TMLanes_fill(lanes, l, next, done, arg);
+}
+
+#define LOAD(a) _mm256_loadu_si256((__m256i*)(a))
+#define STORE(a, v) _mm256_storeu_si256((__m256i*)(a), v)
+
+/*
+ * Run all the lanes in lockstep: a step gathers the cells under
+ * the heads and then their transitions, scatters the new symbols
+ * (a store per lane, inactive lanes writing to the scratch cell)
+ * and moves the heads. A lane leaving the active mask is handled
+ * by TMLanes_stop.
+ */
+__attribute__((target("avx2")))
+void TMLanes_vector(TMLanes* lanes, TMLanesNext next, TMLanesDone done, void *arg){
+	for (int l = 0; l < TM_LANES; l++)
+		TMLanes_fill(lanes, l, next, done, arg);
+
+	TM *machine = lanes->machine;
+	int *cells = (int*)lanes->cells, *table = machine->t;
+	int32_t first[TM_LANES], last[TM_LANES], at[TM_LANES], sym[TM_LANES];
+	for (int l = 0; l < TM_LANES; l++){
+		first[l] = l * W;
+		last[l] = (l + 1) * W - 1;
+	}
+	const __m256i zero = _mm256_setzero_si256(),
+				  one = _mm256_set1_epi32(1),
+				  two = _mm256_set1_epi32(TM_RIGHT),
+				  amask = _mm256_set1_epi32((1u << machine->abits) - 1),
+				  n = _mm256_set1_epi32(machine->n),
+				  scratch = _mm256_set1_epi32(TM_LANES * W),
+				  lb = LOAD(first),
+				  hb = LOAD(last);
+	const __m128i sshift = _mm_cvtsi32_si128(TM_SHIFT + machine->abits),
+				  ashift = _mm_cvtsi32_si128(TM_SHIFT);
+	__m256i state = LOAD(lanes->state),
+			pos = LOAD(lanes->pos),
+			lo = LOAD(lanes->lo),
+			hi = LOAD(lanes->hi),
+			budget = LOAD(lanes->budget),
+			active = _mm256_cmpgt_epi32(state, zero);
+
+	while (_mm256_movemask_epi8(active)){
+		__m256i a = _mm256_mask_i32gather_epi32(zero, cells, pos, active, 4),
+				t = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(state, one), n), a),
+				e = _mm256_mask_i32gather_epi32(zero, table, t, active, 4);
+		STORE(at, _mm256_blendv_epi8(scratch, pos, active));
+		STORE(sym, _mm256_and_si256(_mm256_srl_epi32(e, ashift), amask));
+		for (int l = 0; l < TM_LANES; l++)
+			cells[at[l]] = sym[l];
+		lo = _mm256_min_epi32(lo, pos);
+		hi = _mm256_max_epi32(hi, pos);
+		// Motion is +1 if TM_RIGHT is set, -1 otherwise.
+		pos = _mm256_add_epi32(pos, _mm256_and_si256(
+					_mm256_sub_epi32(_mm256_and_si256(e, two), one), active));
+		state = _mm256_blendv_epi8(state, _mm256_srl_epi32(e, sshift), active);
+		budget = _mm256_add_epi32(budget, active);
+		__m256i go = _mm256_cmpeq_epi32(_mm256_and_si256(e, one), one),
+				outside = _mm256_or_si256(_mm256_cmpgt_epi32(lb, pos), _mm256_cmpgt_epi32(pos, hb)),
+				still = _mm256_and_si256(_mm256_andnot_si256(outside, go),
+										 _mm256_and_si256(active, _mm256_cmpgt_epi32(budget, zero)));
+		int stopped = _mm256_movemask_ps(_mm256_castsi256_ps(active))
+					  & ~_mm256_movemask_ps(_mm256_castsi256_ps(still));
+		if (!stopped){
+			active = still;
+			continue;
+		}
+		STORE(lanes->state, state);
+		STORE(lanes->pos, pos);
+		STORE(lanes->lo, lo);
+		STORE(lanes->hi, hi);
+		STORE(lanes->budget, budget);
+		for (int l = 0; l < TM_LANES; l++)
+			if (stopped & (1 << l))
+				TMLanes_stop(lanes, l, next, done, arg);
+		state = LOAD(lanes->state);
+		pos = LOAD(lanes->pos);
+		lo = LOAD(lanes->lo);
+		hi = LOAD(lanes->hi);
+		budget = LOAD(lanes->budget);
+		active = _mm256_cmpgt_epi32(state, zero);
+	}
+}
+
+#endif
+
+/*
+ * Run the machine on all the tapes of the source.
+ */
+void TMLanes_run(TMLanes* lanes, TMLanesNext next, TMLanesDone done, void *arg){
+#if defined(__x86_64__)
+	if (lanes->machine->width == 4 && __builtin_cpu_supports("avx2")){
+		TMLanes_vector(lanes, next, done, arg);
+		return;
+	}
+#endif
+	TMLanes_serial(lanes, next, done, arg);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "core.h"
+
+/*
+ * Count of lanes (32-bit elements of an AVX2 vector).
+ */
+#define TM_LANES 8
+/*
+ * Cells of the window of a lane, the head starting in the middle.
+ * A tape whose head leaves its window is finished by the threaded
+ * interpreter. Shall be a multiple of TM_BLOCK_SIZE.
+ */
+#define TM_LANES_WINDOW 1024
+/*
+ * Steps a lane runs before its step count is brought up to date.
+ */
+#define TM_LANES_BUDGET (1 << 30)
+
+/*
+ * Source of the tapes: returns the next one (NULL if there is none)
+ * and sets `id` to its index.
+ */
+typedef TMTape* (*TMLanesNext)(void *arg, uint64_t *id);
+/*
+ * Sink of the tapes: takes the tape of index `id` once it has halted
+ * or has run out of steps.
+ */
+typedef void (*TMLanesDone)(void *arg, uint64_t id, TMTape*, uint64_t steps);
+
+/*
+ * Runner of a machine on many tapes in lockstep: each lane holds
+ * a tape in a window of 32-bit cells, states and head positions
+ * of all the lanes are kept in vectors and a step of all of them
+ * gathers their cells and transitions at once. A lane whose tape
+ * halts takes the next one from the source.
+ *
+ * Without AVX2 (or with 64-bit transitions), the tapes are run
+ * one by one with the threaded interpreter.
+ */
+typedef struct {
+	TM *machine;
+	TMThreaded *threaded;      // of tapes leaving their windows
+	uint64_t max;              // step limit of a tape (0 for none)
+	uint32_t *cells;           // windows of the lanes and a scratch cell
+	uint64_t *buffer;          // a window of 64-bit cells
+	TMTape *tape[TM_LANES];    // tape of a lane (NULL if it is empty)
+	uint64_t id[TM_LANES],     // index of the tape of a lane
+			 steps[TM_LANES];  // steps done before the current budget
+	int32_t state[TM_LANES],   // lane state
+			pos[TM_LANES],     // head position (index into `cells`)
+			lo[TM_LANES],      // leftmost cell written (index into `cells`)
+			hi[TM_LANES],      // rightmost cell written (index into `cells`)
+			budget[TM_LANES],  // steps the lane may run without a check
+			given[TM_LANES];   // budget given to the lane
+} TMLanes;
+
+/*
+ * Prepare a machine for tapes of the given cell width.
+ */
+TMLanes* TMLanes_init(TM*, uint8_t bits, uint64_t max);
+void TMLanes_free(TMLanes*);
+
+/*
+ * Run the machine on all the tapes of the source and give them to
+ * the sink, in the order they finish. The sink shall free the tapes.
+ */
+void TMLanes_run(TMLanes*, TMLanesNext next, TMLanesDone done, void *arg);
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "loop.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Zobrist key of a symbol at a position (computed, not tabulated:
+ * the tape is unbounded).
+ */
+static inline uint64_t TMLoop_key(int64_t pos, uint64_t sym){
+	uint64_t x = (uint64_t)pos * 0x9e3779b97f4a7c15ull + (sym + 1) * 0xd6e8feb86659fd93ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+/*
+ * Key of a cell; cells holding their undefined symbol have none,
+ * so taking new blocks into use does not change the hash.
+ */
+static inline uint64_t TMLoop_cell(TMTape* tape, int64_t pos, uint64_t sym){
+	return sym == TMTape_undefined(tape, pos) ? 0 : TMLoop_key(pos, sym);
+}
+
+/*
+ * Hash of the configuration.
+ */
+static inline uint64_t TMLoop_config(uint64_t hash, TMTape* tape){
+	return hash ^ TMLoop_key(~tape->pos, tape->state);
+}
+
+/*
+ * Hash of the tape contents in the blocks in use.
+ */
+uint64_t TMLoop_hash(TMTape* tape){
+	uint64_t hash = 0;
+	for (int64_t i = -tape->bl * TM_BLOCK_SIZE; i < tape->br * TM_BLOCK_SIZE; i++)
+		hash ^= TMLoop_cell(tape, i, TMTape_get(tape, i));
+	return hash;
+}
+
+/*
+ * Do a step of a running machine, updating the tape hash.
+ */
+void TMLoop_step(TM* machine, TMTape* tape, uint64_t *hash){
+	uint64_t sym = TMTape_read(tape),
+			 e = TM_entry(machine, tape->state, sym),
+			 to = TM_entry_symbol(machine, e);
+	if (to != sym){
+		*hash ^= TMLoop_cell(tape, tape->pos, sym) ^ TMLoop_cell(tape, tape->pos, to);
+		TMTape_write(tape, to);
+	}
+	tape->state = TM_entry_state(machine, e);
+	TMTape_step(tape, TM_entry_motion(e));
+}
+
+/*
+ * Compare configurations of two tapes.
+ */
+bool TMLoop_equal(TMTape* a, TMTape* b){
+	if (a->state != b->state || a->pos != b->pos)
+		return false;
+	int64_t lo = -(a->bl > b->bl ? a->bl : b->bl) * TM_BLOCK_SIZE,
+			hi = (a->br > b->br ? a->br : b->br) * TM_BLOCK_SIZE;
+	for (int64_t i = lo; i < hi; i++)
+		if (TMTape_read_at(a, i) != TMTape_read_at(b, i))
+			return false;
+	return true;
+}
+
+/*
+ * Save the configuration.
+ */
+void TMLoop_save(TMLoop* loop, TMTape* tape){
+	TMLoopSnapshot *snapshot = &loop->snapshot;
+	snapshot->hash = TMLoop_config(loop->hash, tape);
+	snapshot->state = tape->state;
+	snapshot->pos = tape->pos;
+	snapshot->lo = -tape->bl * TM_BLOCK_SIZE;
+	snapshot->hi = tape->br * TM_BLOCK_SIZE - 1;
+	size_t n = snapshot->hi - snapshot->lo + 1;
+	if (n > snapshot->size){
+		free(snapshot->cells);
+		snapshot->size = 2 * n;
+		snapshot->cells = NEWARR(uint64_t, snapshot->size);
+		assert(snapshot->cells);
+	}
+	TMTape_readmem(tape, snapshot->lo, n, snapshot->cells);
+}
+
+/*
+ * Compare the configuration with the saved one.
+ * The blocks in use never shrink on a fast tape.
+ */
+bool TMLoop_saved(TMLoop* loop, TMTape* tape){
+	TMLoopSnapshot *snapshot = &loop->snapshot;
+	if (snapshot->hash != TMLoop_config(loop->hash, tape)
+		|| snapshot->state != tape->state || snapshot->pos != tape->pos)
+		return false;
+	for (int64_t i = -tape->bl * TM_BLOCK_SIZE; i < tape->br * TM_BLOCK_SIZE; i++){
+		uint64_t sym = i < snapshot->lo || i > snapshot->hi ?
+			TMTape_undefined(tape, i) : snapshot->cells[i - snapshot->lo];
+		if (TMTape_get(tape, i) != sym)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Find the count of steps before a loop of the given period
+ * by running two copies of the initial tape `period` steps apart.
+ */
+uint64_t TMLoop_preperiod(TMLoop* loop, uint64_t period){
+	TMTape *a = TMTape_clone(loop->initial), *b = TMTape_clone(loop->initial);
+	uint64_t ha = loop->initial_hash, hb = loop->initial_hash, mu = 0;
+	for (uint64_t i = 0; i < period; i++)
+		TMLoop_step(loop->machine, a, &ha);
+	while (TMLoop_config(ha, a) != TMLoop_config(hb, b) || !TMLoop_equal(a, b)){
+		TMLoop_step(loop->machine, a, &ha);
+		TMLoop_step(loop->machine, b, &hb);
+		mu++;
+	}
+	TMTape_free(a);
+	TMTape_free(b);
+	return mu;
+}
+
+/*
+ * The head has reached a new record position on the right
+ * (or, unless `right`, on the left): look for an earlier record
+ * in the same state with the same cells behind it, the head
+ * having stayed within them since. The cells ahead of both
+ * are undefined (blank), so the machine repeats itself shifted.
+ */
+bool TMLoop_record(TMLoop* loop, TMTape* tape, bool right){
+	if (!tape->state || loop->machine->ok[tape->state - 1])
+		return false;
+	int64_t dir = right ? 1 : -1, pos = tape->pos;
+	uint64_t k = TM_LOOP_RECORDS, q = loop->machine->q;
+	TMLoopRecord *records = loop->record[right];
+	for (uint64_t i = 0; i < q * k; i++)
+		if (records[i].state && (records[i].reach - loop->reach[right]) * dir > 0)
+			records[i].reach = loop->reach[right];
+	loop->reach[right] = pos;
+
+	TMLoopRecord *same = records + tape->state * k;
+	for (uint64_t i = 0; i < k; i++){
+		TMLoopRecord *r = same + i;
+		int64_t back = (r->pos - r->reach) * dir;
+		if (!r->state || back >= TM_LOOP_WINDOW)
+			continue;
+		int64_t j = 0;
+		while (j <= back && r->window[j] == TMTape_read_at(tape, pos - j * dir))
+			j++;
+		if (j > back){
+			loop->found = TM_LOOP_TRANSLATED;
+			loop->period = loop->step - r->step;
+			loop->preperiod = r->step;
+			loop->shift = pos - r->pos;
+			return true;
+		}
+	}
+
+	TMLoopRecord *r = same + loop->ring[right][tape->state];
+	loop->ring[right][tape->state] = (loop->ring[right][tape->state] + 1) % k;
+	r->state = tape->state;
+	r->step = loop->step;
+	r->pos = r->reach = pos;
+	for (int64_t j = 0; j < TM_LOOP_WINDOW; j++)
+		r->window[j] = TMTape_read_at(tape, pos - j * dir);
+	return false;
+}
+
+/*
+ * Start looking for loops of a machine on a fast tape.
+ */
+TMLoop* TMLoop_init(TM* machine, TMTape* tape){
+	assert(tape->fast);
+	TMLoop* loop = NEWSTR(TMLoop);
+	assert(loop);
+	loop->machine = machine;
+	loop->initial = TMTape_clone(tape);
+	loop->hash = loop->initial_hash = TMLoop_hash(tape);
+	loop->step = 0;
+	loop->power = 1;
+	loop->lam = 0;
+	loop->snapshot = (TMLoopSnapshot){ 0 };
+	TMLoop_save(loop, tape);
+	loop->found = TM_LOOP_NONE;
+	loop->period = loop->preperiod = 0;
+	loop->shift = 0;
+
+	// Records are beyond the initial contents, on sides without a pattern.
+	int64_t lo = -tape->bl * TM_BLOCK_SIZE, hi = tape->br * TM_BLOCK_SIZE - 1;
+	loop->edge[0] = loop->edge[1] = tape->pos;
+	for (int64_t i = lo; i <= hi; i++)
+		if (TMTape_get(tape, i)){
+			loop->edge[0] = i < loop->edge[0] ? i : loop->edge[0];
+			loop->edge[1] = i > loop->edge[1] ? i : loop->edge[1];
+		}
+	if (tape->nr){
+		loop->edge[0] = tape->ranges[0].start < loop->edge[0] ? tape->ranges[0].start : loop->edge[0];
+		loop->edge[1] = tape->ranges[tape->nr - 1].end > loop->edge[1] ?
+						tape->ranges[tape->nr - 1].end : loop->edge[1];
+	}
+	if (tape->left.n)
+		loop->edge[0] = INT64_MIN;
+	if (tape->right.n)
+		loop->edge[1] = INT64_MAX;
+	for (int side = 0; side < 2; side++){
+		loop->reach[side] = tape->pos;
+		loop->record[side] = calloc(machine->q * TM_LOOP_RECORDS, sizeof(TMLoopRecord));
+		loop->ring[side] = calloc(machine->q, sizeof(uint8_t));
+		assert(loop->record[side] && loop->ring[side]);
+		for (uint64_t i = 0; i < machine->q * TM_LOOP_RECORDS; i++){
+			loop->record[side][i].window = NEWARR(uint64_t, TM_LOOP_WINDOW);
+			assert(loop->record[side][i].window);
+		}
+	}
+	return loop;
+}
+
+void TMLoop_free(TMLoop* loop){
+	for (int side = 0; side < 2; side++){
+		for (uint64_t i = 0; i < loop->machine->q * TM_LOOP_RECORDS; i++)
+			free(loop->record[side][i].window);
+		free(loop->record[side]);
+		free(loop->ring[side]);
+	}
+	free(loop->snapshot.cells);
+	TMTape_free(loop->initial);
+	free(loop);
+}
+
+/*
+ * Run at most `max` steps, stopping at a proven loop.
+ */
+uint64_t TMLoop_run(TMLoop* loop, TMTape* tape, uint64_t max){
+	uint64_t done = 0;
+	while (done < max && !loop->found && tape->state && !loop->machine->ok[tape->state - 1]){
+		TMLoop_step(loop->machine, tape, &loop->hash);
+		loop->step++;
+		done++;
+
+		// Brent: compare with the configuration saved at the last power of 2.
+		loop->lam++;
+		if (TMLoop_saved(loop, tape)){
+			loop->found = TM_LOOP_EXACT;
+			loop->period = loop->lam;
+			loop->preperiod = TMLoop_preperiod(loop, loop->lam);
+			loop->shift = 0;
+			break;
+		}
+		if (loop->lam == loop->power){
+			TMLoop_save(loop, tape);
+			loop->power *= 2;
+			loop->lam = 0;
+		}
+
+		if (tape->pos < loop->reach[1])
+			loop->reach[1] = tape->pos;
+		if (tape->pos > loop->reach[0])
+			loop->reach[0] = tape->pos;
+		if (tape->pos > loop->edge[1]){
+			loop->edge[1] = tape->pos;
+			if (TMLoop_record(loop, tape, true))
+				break;
+		} else if (tape->pos < loop->edge[0]){
+			loop->edge[0] = tape->pos;
+			if (TMLoop_record(loop, tape, false))
+				break;
+		}
+	}
+	return done;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "core.h"
+
+/*
+ * Cells behind a record position kept to detect translated cycles.
+ */
+#define TM_LOOP_WINDOW 128
+/*
+ * Records kept per state on either side of the tape.
+ */
+#define TM_LOOP_RECORDS 4
+
+#define TM_LOOP_NONE 0
+#define TM_LOOP_EXACT 1      // a configuration repeats
+#define TM_LOOP_TRANSLATED 2 // a configuration repeats shifted at a record edge
+
+/*
+ * The head reaching a cell never visited before (beyond
+ * the initial contents) in state `state` at step `step`.
+ * `reach` is the furthest position back from the edge
+ * the head has visited since, `window` are the cells
+ * behind `pos` at that step (`pos` first).
+ */
+typedef struct {
+	uint64_t state, step;
+	int64_t pos, reach;
+	uint64_t *window;
+} TMLoopRecord;
+
+/*
+ * A saved configuration.
+ */
+typedef struct {
+	uint64_t hash, state;
+	int64_t pos, lo, hi;  // cells [lo..hi] are saved
+	uint64_t *cells;
+	size_t size;          // capacity of `cells`
+} TMLoopSnapshot;
+
+/*
+ * Loop detector: runs a machine keeping a Zobrist hash of
+ * its configuration (updated on each write) and finds exact
+ * cycles with Brent's algorithm and translated cycles by
+ * comparing tape contents behind record positions.
+ */
+typedef struct {
+	TM *machine;
+	TMTape *initial;       // copy of the initial tape (for the pre-period)
+	uint64_t hash,         // tape hash
+			 initial_hash;
+	uint64_t step;         // steps done
+	uint64_t power, lam;   // Brent's algorithm
+	TMLoopSnapshot snapshot;
+	int64_t edge[2],       // record positions (left, right), INT64_MIN/MAX if patterned
+			reach[2];      // furthest position back from the edges since their last records
+	TMLoopRecord *record[2];  // TM_LOOP_RECORDS per state (ring)
+	uint8_t *ring[2];         // next record to replace per state
+	uint8_t found;         // TM_LOOP_*
+	uint64_t period,       // steps in the loop
+			 preperiod;    // steps before it
+	int64_t shift;         // cells the configuration is shifted by after `period` steps
+} TMLoop;
+
+/*
+ * Start looking for loops of a machine on a fast tape.
+ */
+TMLoop* TMLoop_init(TM*, TMTape*);
+void TMLoop_free(TMLoop*);
+
+/*
+ * Run at most `max` steps, stopping early if the machine halts
+ * or a loop is proven (`found` is set then).
+ * Return the count of steps done.
+ */
+uint64_t TMLoop_run(TMLoop*, TMTape*, uint64_t max);
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "macro.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Prepare a macro machine with blocks of `k` cells.
+ */
+TMMacro* TMMacro_init(TM* machine, uint8_t bits, uint64_t k){
+	if (!k || k > TM_BLOCK_SIZE || (k & (k - 1)))
+		return NULL;
+	TMMacro* macro = NEWSTR(TMMacro);
+	assert(macro);
+	macro->machine = machine;
+	macro->bits = bits;
+	macro->k = k;
+	macro->words = (k * bits + 63) / 64;
+	macro->size = TM_MACRO_CAPACITY;
+	macro->used = 0;
+	macro->entries = calloc(macro->size, sizeof(TMMacroEntry));
+	macro->blocks = NEWARR(uint64_t, macro->size * 2 * macro->words);
+	macro->cells = NEWARR(uint64_t, k);
+	assert(macro->entries && macro->blocks && macro->cells);
+	return macro;
+}
+
+void TMMacro_free(TMMacro* macro){
+	free(macro->entries);
+	free(macro->blocks);
+	free(macro->cells);
+	free(macro);
+}
+
+/*
+ * Copy the raw block starting at `base` from the tape to `raw`
+ * (or back, if `write`).
+ */
+void TMMacro_copy(TMMacro* macro, TMTape* tape, int64_t base, uint64_t *raw, bool write){
+	if (macro->bits == 1){
+		uint64_t *word = (uint64_t*)tape->cells + (base >> 6),
+				 mask = macro->k == 64 ? ~0ull : (1ull << macro->k) - 1;
+		if (write)
+			*word = (*word & ~(mask << (base & 63))) | (raw[0] << (base & 63));
+		else
+			raw[0] = (*word >> (base & 63)) & mask;
+		return;
+	}
+	uint8_t *cells = (uint8_t*)tape->cells + base * (macro->bits / 8);
+	if (write)
+		memcpy(cells, raw, macro->k * macro->bits / 8);
+	else {
+		raw[macro->words - 1] = 0;
+		memcpy(raw, cells, macro->k * macro->bits / 8);
+	}
+}
+
+/*
+ * Unpack a raw block into one cell per word (or pack it, if `pack`).
+ */
+void TMMacro_unpack(TMMacro* macro, uint64_t *raw, uint64_t *cells, bool pack){
+	for (uint64_t i = 0; i < macro->k; i++)
+		switch (macro->bits){
+			case 1:
+				if (pack)
+					raw[0] = (raw[0] & ~(1ull << i)) | (cells[i] << i);
+				else
+					cells[i] = (raw[0] >> i) & 1;
+				break;
+			case 8:
+				if (pack)
+					((uint8_t*)raw)[i] = cells[i];
+				else
+					cells[i] = ((uint8_t*)raw)[i];
+				break;
+			case 16:
+				if (pack)
+					((uint16_t*)raw)[i] = cells[i];
+				else
+					cells[i] = ((uint16_t*)raw)[i];
+				break;
+			case 32:
+				if (pack)
+					((uint32_t*)raw)[i] = cells[i];
+				else
+					cells[i] = ((uint32_t*)raw)[i];
+				break;
+			default:
+				if (pack)
+					raw[i] = cells[i];
+				else
+					cells[i] = raw[i];
+		}
+}
+
+/*
+ * Run the machine inside of a block for at most `max` steps,
+ * until it leaves the block or halts. Returns the count of steps.
+ */
+uint64_t TMMacro_simulate(TMMacro* macro, uint64_t *state, int64_t *pos, uint64_t max){
+	TM* machine = macro->machine;
+	uint64_t steps = 0;
+	while (steps < max && *pos >= 0 && *pos < (int64_t)macro->k
+		   && *state && !machine->ok[*state - 1]){
+		uint64_t e = TM_entry(machine, *state, macro->cells[*pos]);
+		macro->cells[*pos] = TM_entry_symbol(machine, e);
+		*pos += TM_entry_motion(e) ? 1 : -1;
+		*state = TM_entry_state(machine, e);
+		steps++;
+	}
+	return steps;
+}
+
+uint64_t TMMacro_hash(TMMacro* macro, uint64_t state, int64_t pos, uint64_t *raw){
+	uint64_t h = (state * 0x9e3779b97f4a7c15ull) ^ (uint64_t)pos;
+	for (uint64_t i = 0; i < macro->words; i++){
+		h = (h ^ raw[i]) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 32;
+	}
+	return h;
+}
+
+/*
+ * Find the slot of a macro transition (or the empty slot for it).
+ */
+uint64_t TMMacro_find(TMMacro* macro, uint64_t state, int64_t pos, uint64_t *raw){
+	uint64_t mask = macro->size - 1,
+			 i = TMMacro_hash(macro, state, pos, raw) & mask;
+	for (;; i = (i + 1) & mask){
+		TMMacroEntry *entry = macro->entries + i;
+		if (!entry->state || (entry->state == state && entry->pos == pos
+			&& !memcmp(macro->blocks + i * 2 * macro->words, raw, macro->words * 8)))
+			return i;
+	}
+}
+
+/*
+ * Double the cache.
+ */
+void TMMacro_grow(TMMacro* macro){
+	TMMacroEntry *entries = macro->entries;
+	uint64_t *blocks = macro->blocks, size = macro->size, w = macro->words;
+	macro->size *= 2;
+	macro->entries = calloc(macro->size, sizeof(TMMacroEntry));
+	macro->blocks = NEWARR(uint64_t, macro->size * 2 * w);
+	assert(macro->entries && macro->blocks);
+	for (uint64_t i = 0; i < size; i++){
+		if (!entries[i].state)
+			continue;
+		uint64_t j = TMMacro_find(macro, entries[i].state, entries[i].pos, blocks + i * 2 * w);
+		macro->entries[j] = entries[i];
+		memcpy(macro->blocks + j * 2 * w, blocks + i * 2 * w, 2 * w * 8);
+	}
+	free(entries);
+	free(blocks);
+}
+
+/*
+ * Get the macro transition for a block, computing it if needed.
+ */
+TMMacroEntry* TMMacro_lookup(TMMacro* macro, uint64_t state, int64_t pos, uint64_t *raw){
+	uint64_t i = TMMacro_find(macro, state, pos, raw), w = macro->words;
+	TMMacroEntry *entry = macro->entries + i;
+	if (entry->state)
+		return entry;
+	if (2 * (macro->used + 1) > macro->size){
+		TMMacro_grow(macro);
+		i = TMMacro_find(macro, state, pos, raw);
+		entry = macro->entries + i;
+	}
+
+	uint64_t *old = macro->blocks + i * 2 * w, *new = old + w;
+	memcpy(old, raw, w * 8);
+	memcpy(new, raw, w * 8);
+	TMMacro_unpack(macro, raw, macro->cells, false);
+	entry->state = state;
+	entry->pos = pos;
+	entry->to = state;
+	entry->exit = pos;
+	entry->steps = TMMacro_simulate(macro, &entry->to, &entry->exit, TM_MACRO_STEPS + 1);
+	if (entry->steps > TM_MACRO_STEPS)
+		entry->steps = 0;
+	else
+		TMMacro_unpack(macro, new, macro->cells, true);
+	macro->used++;
+	return entry;
+}
+
+/*
+ * Run at most `max` steps on a fast tape.
+ */
+uint64_t TMMacro_run(TMMacro* macro, TMTape* tape, uint64_t max){
+	assert(tape->bits == macro->bits && tape->fast);
+	uint64_t done = 0, w = macro->words;
+	uint64_t raw[w];
+	while (done < max && tape->state && !macro->machine->ok[tape->state - 1]){
+		// The head is always inside of the blocks in use, so is its macro block.
+		int64_t base = tape->pos & ~(int64_t)(macro->k - 1),
+				pos = tape->pos - base;
+		TMMacro_copy(macro, tape, base, raw, false);
+		TMMacroEntry *entry = TMMacro_lookup(macro, tape->state, pos, raw);
+
+		if (entry->steps && entry->steps <= max - done){
+			uint64_t *new = macro->blocks + (entry - macro->entries) * 2 * w + w;
+			TMMacro_copy(macro, tape, base, new, true);
+			tape->state = entry->to;
+			pos = entry->exit;
+			done += entry->steps;
+		} else {
+			// Too long a stay or too few steps left: go cell by cell.
+			uint64_t state = tape->state;
+			TMMacro_unpack(macro, raw, macro->cells, false);
+			done += TMMacro_simulate(macro, &state, &pos, max - done);
+			TMMacro_unpack(macro, raw, macro->cells, true);
+			TMMacro_copy(macro, tape, base, raw, true);
+			tape->state = state;
+		}
+
+		// Leaving the blocks in use allocates a new one, as TMTape_step does.
+		tape->pos = base + pos;
+		if (tape->pos < -tape->bl * TM_BLOCK_SIZE)
+			TMTape_alloc(tape, false);
+		else if (tape->pos >= tape->br * TM_BLOCK_SIZE)
+			TMTape_alloc(tape, true);
+	}
+	return done;
+}
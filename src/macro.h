@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "core.h"
+
+/*
+ * Longest stay inside of a block which is cached;
+ * longer ones are simulated cell by cell.
+ */
+#define TM_MACRO_STEPS (1 << 20)
+/*
+ * Initial count of cached macro transitions.
+ */
+#define TM_MACRO_CAPACITY 1024
+
+/*
+ * A cached macro transition: entering a block in state `state`
+ * at cell `pos` of it, the machine leaves it (or halts) after
+ * `steps` steps in state `to` at position `exit` relative to
+ * the block start (-1 and k are the neighbouring blocks).
+ * Block contents before and after are kept in TMMacro.blocks.
+ */
+typedef struct {
+	uint64_t state,  // 0 marks an empty slot
+			 to,
+			 steps;  // 0 if the stay is too long to be cached
+	int64_t pos,
+			exit;
+} TMMacroEntry;
+
+/*
+ * Macro machine: blocks of `k` aligned cells are macro symbols
+ * and macro transitions are computed the first time they are
+ * met. Blocks never cross tape blocks, so the tape extent
+ * grows exactly as with TM_run.
+ */
+typedef struct {
+	TM *machine;
+	uint8_t bits;              // cell width
+	uint64_t k,                // cells per block (a power of 2 up to TM_BLOCK_SIZE)
+			 words;            // 64-bit words per raw block
+	uint64_t size, used;       // slots in the cache, slots in use
+	TMMacroEntry *entries;
+	uint64_t *blocks;          // raw contents before and after, 2 * words per slot
+	uint64_t *cells;           // scratch block, one cell per word
+} TMMacro;
+
+/*
+ * Prepare a macro machine with blocks of `k` cells
+ * for tapes of the given cell width.
+ * Returns NULL if `k` is not supported.
+ */
+TMMacro* TMMacro_init(TM*, uint8_t bits, uint64_t k);
+void TMMacro_free(TMMacro*);
+
+/*
+ * Run at most `max` steps on a fast tape (exactly `max`,
+ * unless the machine halts). Return the count of steps done.
+ */
+uint64_t TMMacro_run(TMMacro*, TMTape*, uint64_t max);
@@ -14,14 +14,27 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <locale.h>
 #include <time.h>
 #include <argp.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include "util.h"
 #include "core.h"
 #include "interpreter.h"
 #include "tui.h"
+#include "native.h"
+#include "jit.h"
+#include "macro.h"
+#include "rle.h"
+#include "loop.h"
+#include "bouncer.h"
+#include "backward.h"
+#include "enumerate.h"
+#include "batch.h"
+#include "lanes.h"
+#include "tmc.h"
 
 
 // TODO: improve doc.
@@ -48,6 +61,11 @@ static char doc[] = "A swift Turing machine simulator\n\n"
 					"All transitions are undefined by default.\n"
 					"Entries may overwrite previous ones.\n"
 					"Machine in undefined state halts with error code 1.\n"
+					"Machine proven to loop (--detect-loops) stops "
+					"with error code 2.\n"
+					"Machine proven not to halt by a decider (--bouncer, "
+					"--backward) exits with error code 2 without being "
+					"run.\n"
 					"You may define a transition from undefined "
 					"(`null`) symbol.\n"
 					"You may not define transition from undefined state.\n"
@@ -87,11 +105,36 @@ static char doc[] = "A swift Turing machine simulator\n\n"
 					"`end` position\n"
 					"Tape entries overwrite previous ones if intersections "
 					"occur.";
-static char args_doc[] = "MACHINE_FILE";
+static char args_doc[] = "MACHINE_FILE\n--batch PATH...";
 
 #define OPT_TUI 1
 #define OPT_TAPE 2
 #define OPT_FRAME 3
+#define OPT_EMIT_C 4
+#define OPT_BUILD 5
+#define OPT_NATIVE 6
+#define OPT_JIT 7
+#define OPT_MACRO 8
+#define OPT_RLE 9
+#define OPT_DETECT_LOOPS 10
+#define OPT_BOUNCER 11
+#define OPT_BACKWARD 12
+#define OPT_BACKWARD_MEMORY 13
+#define OPT_ENUMERATE 14
+#define OPT_STEPS 15
+#define OPT_THREADS 16
+#define OPT_SHARD 17
+#define OPT_CHECKPOINT 18
+#define OPT_CHECKPOINT_INTERVAL 19
+#define OPT_MERGE 20
+#define OPT_BATCH 21
+#define OPT_TIME_LIMIT 22
+#define OPT_FORMAT 23
+#define OPT_TAPES 24
+#define OPT_COMPILE 25
+#define OPT_NO_CACHE 26
+#define OPT_TAPE_FILE 27
+#define OPT_TAPE_MEMORY 28
 
 static struct argp_option options[] = {
 	{ "fast", 'f', 0, OPTION_ARG_OPTIONAL, 
@@ -105,6 +148,17 @@ static struct argp_option options[] = {
 					"Use tape from the specified file; the tape from "
 					"the machine file is ignored, if is" },
 
+	{ "tape-file", OPT_TAPE_FILE, "PATH", 0, 
+					"Keep the tape in PATH (created or truncated), a "
+					"sparse file mapped into memory, so that tapes "
+					"larger than the memory can be run; the final tape "
+					"is left there (not with --native)" },
+
+	{ "tape-memory", OPT_TAPE_MEMORY, "SIZE", 0, 
+					"Memory of --tape-file kept around the head in "
+					"bytes, with an optional K, M or G suffix (256M by "
+					"default); the rest is paged out" },
+
 	{ "speed", 's', "SPEED", OPTION_ARG_OPTIONAL, 
 					"Set speed of simulation (0 - slowest, 10 - no "
 					"delays, default 7)" },
@@ -115,16 +169,175 @@ static struct argp_option options[] = {
 	{ "frame", OPT_FRAME, 0, OPTION_ARG_OPTIONAL, 
 					"Draw frame around tape" },
 
+	{ "emit-c", OPT_EMIT_C, "C_FILE", 0, 
+					"Write a C source specialised for the machine "
+					"and its tape, then exit" },
+
+	{ "build", OPT_BUILD, "OUT", 0, 
+					"Compile the machine and its tape into a native "
+					"program (or into a shared object exposing `run`, "
+					"if OUT ends with .so) with gcc, then exit" },
+
+	{ "native", OPT_NATIVE, "SHARED_OBJECT", 0, 
+					"Run the machine with `run` from a shared object "
+					"built with --build (implies --fast)" },
+
+	{ "jit", OPT_JIT, 0, 0, 
+					"Compile the machine into x86-64 code at startup "
+					"and run it (implies --fast); falls back to the "
+					"interpreter when unsupported" },
+
+	{ "macro", OPT_MACRO, "K", 0, 
+					"Simulate blocks of K cells as single symbols, "
+					"caching the transitions between blocks (K is "
+					"a power of 2 up to 16; implies --fast)" },
+
+	{ "rle", OPT_RLE, 0, 0, 
+					"Keep the tape run-length encoded and cross runs "
+					"rewritten by a state looping on itself at once "
+					"(implies --fast)" },
+
+	{ "detect-loops", OPT_DETECT_LOOPS, 0, 0, 
+					"Stop when the machine is proven to loop forever "
+					"(a configuration repeats, possibly shifted at an "
+					"edge of the tape), report the period and the "
+					"steps before the loop and exit with code 2 "
+					"(implies --fast, not with --native, --jit, "
+					"--macro or --rle)" },
+
+	{ "bouncer", OPT_BOUNCER, "STEPS", OPTION_ARG_OPTIONAL, 
+					"Try to prove that the machine never halts "
+					"because its tape grows linearly with the head "
+					"sweeping between the edges, running it for at "
+					"most STEPS steps (1000000 by default); report "
+					"the proof and exit with code 2 if found, 0 "
+					"otherwise" },
+
+	{ "backward", OPT_BACKWARD, "DEPTH", OPTION_ARG_OPTIONAL, 
+					"Try to prove that the machine cannot halt by "
+					"searching back from its halting transitions for "
+					"at most DEPTH steps (32 by default); report the "
+					"proof and exit with code 2 if found, 0 otherwise "
+					"(run before --bouncer if both are given)" },
+
+	{ "backward-memory", OPT_BACKWARD_MEMORY, "SIZE", 0, 
+					"Memory budget of --backward in bytes, with an "
+					"optional K, M or G suffix (64M by default)" },
+
+	{ "enumerate", OPT_ENUMERATE, "N,M", 0, 
+					"Instead of running MACHINE_FILE, enumerate all "
+					"N-state M-symbol machines in Tree Normal Form on "
+					"a blank tape and print a line per machine: its "
+					"transitions, H (halted) with the steps and the "
+					"non-blank cells or U (still running after the "
+					"step limit)" },
+
+	{ "steps", OPT_STEPS, "LIMIT", 0, 
+					"Step limit of a machine of --enumerate "
+					"(1000000 by default), --batch or --tapes (none "
+					"by default)" },
+
+	{ "threads", OPT_THREADS, "K", 0, 
+					"Threads of --enumerate or --batch (one per core "
+					"by default)" },
+
+	{ "shard", OPT_SHARD, "I/N", 0, 
+					"Only enumerate shard I (from 0) of N disjoint parts "
+					"of the space (--enumerate), each of them can be run "
+					"by an independent process" },
+
+	{ "checkpoint", OPT_CHECKPOINT, "PATH", 0, 
+					"Save the run to PATH periodically and resume it "
+					"from there if PATH exists (implies --fast, not "
+					"with --detect-loops); with --enumerate the records "
+					"are written to PATH and the frontier to PATH.ckpt" },
+
+	{ "checkpoint-interval", OPT_CHECKPOINT_INTERVAL, "SECONDS", 0, 
+					"Seconds between checkpoints (60 by default)" },
+
+	{ "merge", OPT_MERGE, "PATH,...", 0, 
+					"Instead of running MACHINE_FILE, concatenate the "
+					"records of the finished shards of an enumeration "
+					"(run with --checkpoint) and print the statistics" },
+
+	{ "batch", OPT_BATCH, 0, 0, 
+					"Run all the given machine files (the .dtm files "
+					"of directories, the paths read from stdin for "
+					"`-`) on a pool of threads and print a line per "
+					"machine: the file, its status, last state, "
+					"steps, leftmost and rightmost non-blank cells "
+					"and wall time" },
+
+	{ "time-limit", OPT_TIME_LIMIT, "SECONDS", 0, 
+					"Time limit of a machine of --batch (none by "
+					"default)" },
+
+	{ "format", OPT_FORMAT, "FORMAT", 0, 
+					"Output format of --batch or --tapes: csv (default) "
+					"or jsonl" },
+
+	{ "compile", OPT_COMPILE, "TMC_FILE", 0, 
+					"Write the compiled machine and its tape into a "
+					"binary file, then exit; such a file may be given "
+					"instead of MACHINE_FILE and is loaded without "
+					"parsing" },
+
+	{ "no-cache", OPT_NO_CACHE, 0, 0, 
+					"Do not look compiled machines up in the cache "
+					"(TM_CACHE_DIR, $XDG_CACHE_HOME/tm or ~/.cache/tm) "
+					"nor store them there" },
+
+	{ "tapes", OPT_TAPES, "TAPES_FILE", 0, 
+					"Run the machine on every tape of the file (tape "
+					"entries, tapes separated by =-=-= lines) on SIMD "
+					"lanes and print a line per tape: its index, status, "
+					"last state, steps, leftmost and rightmost non-blank "
+					"cells and the symbols between them" },
+
 	{ 0 }
 };
 
 struct arguments {
-	bool fast, ultrafast, tui, frame;
+	bool fast, ultrafast, tui, frame, jit, rle, loops;
 	int8_t speed;
 	char *in;
 	char *tape;
+	char *tape_file;
+	uint64_t tape_memory;
+	char *emit_c, *build, *native;
+	uint64_t macro, bouncer, backward, backward_memory;
+	uint64_t states, symbols, steps, threads;
+	uint64_t shard, shards, interval;
+	char *checkpoint, *merge, *tapes, *compile;
+	bool batch, json, no_cache;
+	double limit;
+	char **files;
+	size_t nfiles;
 };
 
+/*
+ * Parse a size in bytes with an optional K, M or G suffix.
+ */
+static bool parse_size(char *arg, uint64_t *size){
+	char *end;
+	if (!isdigit(*arg))
+		return false;
+	*size = strtoull(arg, &end, 10);
+	switch (*end){
+		case 'G':
+			*size <<= 10;
+			// fall through
+		case 'M':
+			*size <<= 10;
+			// fall through
+		case 'K':
+			*size <<= 10;
+			end++;
+			break;
+	}
+	return *end == '\0' && *size;
+}
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state){
 	struct arguments *args = state->input;
 	switch(key){
@@ -154,12 +367,137 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state){
 		case OPT_TAPE:
 			args->tape = arg;
 			break;
-		case ARGP_KEY_ARG: 
-			if (state->argc != state->next)
+		case OPT_TAPE_FILE:
+			args->tape_file = arg;
+			break;
+		case OPT_TAPE_MEMORY:
+			if (!parse_size(arg, &args->tape_memory))
+				argp_usage(state);
+			break;
+		case OPT_EMIT_C:
+			args->emit_c = arg;
+			break;
+		case OPT_BUILD:
+			args->build = arg;
+			break;
+		case OPT_NATIVE:
+			args->native = arg;
+			break;
+		case OPT_JIT:
+			args->jit = true;
+			break;
+		case OPT_RLE:
+			args->rle = true;
+			break;
+		case OPT_DETECT_LOOPS:
+			args->loops = true;
+			break;
+		case OPT_MACRO:
+			for (char *c = arg; *c != '\0'; c++)
+				if (!isdigit(*c))
+					argp_usage(state);
+			if (!sscanf(arg, "%" SCNu64, &args->macro) || !args->macro
+				|| args->macro > TM_BLOCK_SIZE || (args->macro & (args->macro - 1)))
+				argp_usage(state);
+			break;
+		case OPT_BOUNCER:
+			args->bouncer = TM_BOUNCER_MAX;
+			if (arg){
+				for (char *c = arg; *c != '\0'; c++)
+					if (!isdigit(*c))
+						argp_usage(state);
+				if (!sscanf(arg, "%" SCNu64, &args->bouncer) || !args->bouncer)
+					argp_usage(state);
+			}
+			break;
+		case OPT_BACKWARD:
+			args->backward = TM_BACKWARD_DEPTH;
+			if (arg){
+				for (char *c = arg; *c != '\0'; c++)
+					if (!isdigit(*c))
+						argp_usage(state);
+				if (!sscanf(arg, "%" SCNu64, &args->backward) || !args->backward)
+					argp_usage(state);
+			}
+			break;
+		case OPT_BACKWARD_MEMORY:
+			if (!parse_size(arg, &args->backward_memory))
+				argp_usage(state);
+			break;
+		case OPT_ENUMERATE:
+			if (sscanf(arg, "%" SCNu64 ",%" SCNu64, &args->states, &args->symbols) != 2
+				|| !args->states || args->states > TM_ENUM_MAX_STATES
+				|| args->symbols < 2 || args->symbols > TM_ENUM_MAX_SYMBOLS)
+				argp_usage(state);
+			break;
+		case OPT_STEPS:
+			for (char *c = arg; *c != '\0'; c++)
+				if (!isdigit(*c))
+					argp_usage(state);
+			if (!sscanf(arg, "%" SCNu64, &args->steps) || !args->steps)
+				argp_usage(state);
+			break;
+		case OPT_THREADS:
+			for (char *c = arg; *c != '\0'; c++)
+				if (!isdigit(*c))
+					argp_usage(state);
+			if (!sscanf(arg, "%" SCNu64, &args->threads) || !args->threads)
+				argp_usage(state);
+			break;
+		case OPT_SHARD:
+			if (sscanf(arg, "%" SCNu64 "/%" SCNu64, &args->shard, &args->shards) != 2
+				|| args->shard >= args->shards)
+				argp_usage(state);
+			break;
+		case OPT_CHECKPOINT:
+			args->checkpoint = arg;
+			break;
+		case OPT_CHECKPOINT_INTERVAL:
+			for (char *c = arg; *c != '\0'; c++)
+				if (!isdigit(*c))
+					argp_usage(state);
+			if (!sscanf(arg, "%" SCNu64, &args->interval) || !args->interval)
+				argp_usage(state);
+			break;
+		case OPT_MERGE:
+			args->merge = arg;
+			break;
+		case OPT_BATCH:
+			args->batch = true;
+			break;
+		case OPT_TIME_LIMIT: {
+			char *end;
+			args->limit = strtod(arg, &end);
+			if (!isdigit(*arg) || *end != '\0' || !(args->limit > 0))
 				argp_usage(state);
+			break;
+		}
+		case OPT_FORMAT:
+			if (strcmp(arg, "csv") == 0)
+				args->json = false;
+			else if (strcmp(arg, "jsonl") == 0)
+				args->json = true;
+			else
+				argp_usage(state);
+			break;
+		case OPT_TAPES:
+			args->tapes = arg;
+			break;
+		case OPT_COMPILE:
+			args->compile = arg;
+			break;
+		case OPT_NO_CACHE:
+			args->no_cache = true;
+			break;
+		case ARGP_KEY_ARG: 
+			args->files = realloc(args->files, (args->nfiles + 1) * sizeof(char*));
+			assert(args->files);
+			args->files[args->nfiles++] = arg;
 			args->in = arg;
 			break;
 		case ARGP_KEY_END:
+			if (args->nfiles > 1 && !args->batch)
+				argp_usage(state);
 			break;
 		default:
 			return ARGP_ERR_UNKNOWN;
@@ -181,18 +519,349 @@ void set_speed(uint8_t speed){
 	wait->tv_nsec = (delay[speed] % 1000) * 1000000;
 }
 
+/*
+ * Write a C source for the machine and/or build it.
+ */
+int emit(TMExecutable* exec, char *source, char *build){
+	char *path = source;
+	if (!path){
+		path = NEWARR(char, strlen(build) + 3);
+		assert(path);
+		sprintf(path, "%s.c", build);
+	}
+	FILE* file = fopen(path, "w");
+	if (!file){
+		fprintf(stderr, "Could not open %s for writing.\n", path);
+		return 1;
+	}
+	TMExecutable_emit_c(exec, file);
+	fclose(file);
+	int code = 0;
+	if (build){
+		size_t len = strlen(build);
+		bool shared = len > 3 && strcmp(build + len - 3, ".so") == 0;
+		if (!TMNative_build(path, build, shared)){
+			fprintf(stderr, "Could not compile %s.\n", path);
+			code = 1;
+		}
+	}
+	if (path != source)
+		free(path);
+	return code;
+}
+
+/*
+ * Run the requested deciders on the machine and report the results.
+ * Return 2 if one of them has proven that the machine never halts.
+ */
+int decide(TMExecutable* exec, struct arguments *args){
+	if (args->backward){
+		TMBackward result;
+		bool proven = TMBackward_decide(exec->machine, exec->tape, args->backward,
+										args->backward_memory, &result);
+		printf("Backward:%13s\n", proven ? "cannot halt" : "unknown");
+		printf("Depth:  %14lu\n", result.depth);
+		printf("Nodes:  %14lu\n", result.nodes);
+		if (proven)
+			return 2;
+	}
+	if (args->bouncer){
+		TMBouncer proof;
+		if (!TMBouncer_decide(exec->machine, exec->tape, args->bouncer, &proof)){
+			printf("Bouncer:%14s\n", "unknown");
+			return 0;
+		}
+		printf("Bouncer:%14s\n", proof.right ? "right" : "left");
+		printf("State:  %14s\n", TMDict_at(exec->states, proof.state));
+		printf("Record: %14lu\n", proof.step[0]);
+		printf("Record: %14lu\n", proof.step[1]);
+		printf("Unit:   %14lu\n", proof.unit);
+		return 2;
+	}
+	return 0;
+}
+
+/*
+ * Print the statistics of an enumeration.
+ */
+void enumerate_stats(TMEnumStats stats){
+	fprintf(stderr, "Machines:  %12lu\n", stats.machines);
+	fprintf(stderr, "Halted:    %12lu\n", stats.halted);
+	fprintf(stderr, "Undecided: %12lu\n", stats.undecided);
+	fprintf(stderr, "Steps:     %12lu\n", stats.steps);
+	fprintf(stderr, "Ones:      %12lu\n", stats.ones);
+}
+
+/*
+ * Enumerate machines (a shard of them, resuming from the checkpoint
+ * if any) and print the statistics.
+ */
+int enumerate(struct arguments *args){
+	TMEnum* e = TMEnum_init(args->states, args->symbols, args->steps,
+							args->threads, stdout);
+	e->shard = args->shard;
+	e->shards = args->shards;
+	e->interval = args->interval;
+	if (args->checkpoint){
+		e->checkpoint = NEWARR(char, strlen(args->checkpoint) + 6);
+		assert(e->checkpoint);
+		sprintf(e->checkpoint, "%s.ckpt", args->checkpoint);
+		uint64_t length;
+		bool resumed = TMEnum_load(e, &length);
+		e->out = fopen(args->checkpoint, resumed ? "r+" : "w");
+		if (!e->out){
+			fprintf(stderr, "Could not open %s for writing.\n", args->checkpoint);
+			return 1;
+		}
+		if (resumed && (ftruncate(fileno(e->out), length) || fseek(e->out, length, SEEK_SET))){
+			fprintf(stderr, "Could not truncate %s.\n", args->checkpoint);
+			return 1;
+		}
+	}
+	TMEnumStats stats = TMEnum_run(e);
+	if (args->checkpoint){
+		fclose(e->out);
+		free(e->checkpoint);
+	}
+	TMEnum_free(e);
+	enumerate_stats(stats);
+	return 0;
+}
+
+/*
+ * Merge the records of the shards of an enumeration.
+ */
+int merge(char *list){
+	size_t n = 1;
+	for (char *c = list; *c; c++)
+		n += *c == ',';
+	char **paths = NEWARR(char*, n);
+	assert(paths);
+	n = 0;
+	for (char *path = strtok(list, ","); path; path = strtok(NULL, ","))
+		paths[n++] = path;
+	TMEnumStats stats;
+	bool ok = TMEnum_merge(paths, n, stdout, &stats);
+	free(paths);
+	if (ok)
+		enumerate_stats(stats);
+	return !ok;
+}
+
+/*
+ * Run many machine files and print their results.
+ */
+int batch(struct arguments *args){
+	if (!args->nfiles){
+		fprintf(stderr, "No filename specified.\n");
+		return 1;
+	}
+	TMBatch* b = TMBatch_init(args->steps, args->limit, args->json, args->threads, stdout);
+	b->cache = !args->no_cache;
+	for (size_t i = 0; i < args->nfiles; i++)
+		if (!TMBatch_add(b, args->files[i])){
+			TMBatch_free(b);
+			return 1;
+		}
+	uint64_t errors = TMBatch_run(b);
+	TMBatch_free(b);
+	return errors != 0;
+}
+
+/*
+ * Tapes run by --tapes.
+ */
+struct tapes {
+	TMExecutable *exec;
+	TMProgram *program;   // holds the entries of the tape being read
+	TMText *in;
+	FILE *out;
+	bool json;
+	uint64_t n,           // tapes read
+			 errors;      // tapes which could not be read
+	bool more;            // the last tape read ended with a separator
+};
+
+/*
+ * Write the results line of a tape.
+ */
+void tapes_write(struct tapes *t, uint64_t id, const char *status, TMTape* tape, uint64_t steps){
+	char *state = tape ? TMDict_at(t->exec->states, tape->state) : NULL;
+	int64_t left = 0, right = -1;
+	if (tape)
+		TMTape_span(tape, &left, &right);
+	if (t->json){
+		fprintf(t->out, "{\"tape\":%lu,\"status\":\"%s\",\"state\":", id, status);
+		if (state)
+			TMBatch_json(t->out, state);
+		else
+			fprintf(t->out, "null");
+		if (left > right)
+			fprintf(t->out, ",\"steps\":%lu,\"left\":null,\"right\":null,\"output\":\"", steps);
+		else
+			fprintf(t->out, ",\"steps\":%lu,\"left\":%ld,\"right\":%ld,\"output\":\"", steps, left, right);
+	} else {
+		fprintf(t->out, "%lu,%s,", id, status);
+		if (state)
+			TMBatch_csv(t->out, state);
+		if (left > right)
+			fprintf(t->out, ",%lu,,,", steps);
+		else
+			fprintf(t->out, ",%lu,%ld,%ld,", steps, left, right);
+	}
+	// Names are restricted to characters needing no escapes.
+	for (int64_t i = left; i <= right; i++){
+		char *sym = TMDict_at(t->exec->chars, TMTape_read_at(tape, i));
+		fprintf(t->out, i == left ? "%s" : " %s", sym ? sym : "_");
+	}
+	fprintf(t->out, t->json ? "\"}\n" : "\n");
+}
+
+/*
+ * Read the next tape, reporting the ones which cannot be read.
+ */
+TMTape* tapes_next(void *arg, uint64_t *id){
+	struct tapes *t = arg;
+	// Every separator is followed by a tape, empty ones included.
+	while (!TMText_end(t->in) || t->more){
+		TMTape* tape = NULL;
+		if (TMProgram_parse_tape_file(t->program, t->in, &t->more))
+			tape = TMProgram_tape(t->program, t->exec->chars, t->exec->tape->bits, true);
+		else
+			fprintf(stderr, "Could not parse tape %lu.\n", t->n);
+		if (tape)
+			return *id = t->n++, tape;
+		tapes_write(t, t->n++, TM_BATCH_ERROR, NULL, 0);
+		t->errors++;
+	}
+	return NULL;
+}
+
+void tapes_done(void *arg, uint64_t id, TMTape* tape, uint64_t steps){
+	struct tapes *t = arg;
+	const char *status = TM_BATCH_STEPS;
+	if (!tape->state)
+		status = TM_BATCH_UNDEFINED;
+	else if (t->exec->machine->ok[tape->state - 1])
+		status = TM_BATCH_HALTED;
+	tapes_write(t, id, status, tape, steps);
+	TMTape_free(tape);
+}
+
+/*
+ * Run the machine on the tapes of a file and print their results.
+ */
+int tapes(TMExecutable* exec, struct arguments *args){
+	struct tapes t = { exec, NULL, TMText_open(args->tapes), stdout, args->json, 0, 0, false };
+	if (!t.in){
+		fprintf(stderr, "Could not open %s.\n", args->tapes);
+		return 1;
+	}
+	t.program = NEWSTR(TMProgram);
+	assert(t.program);
+	*t.program = (TMProgram){ 0 };
+	if (!t.json)
+		fprintf(t.out, "tape,status,state,steps,left,right,output\n");
+	TMLanes* lanes = TMLanes_init(exec->machine, exec->tape->bits, args->steps);
+	TMLanes_run(lanes, tapes_next, tapes_done, &t);
+	TMLanes_free(lanes);
+	TMProgram_free(t.program);
+	TMText_close(t.in);
+	fflush(t.out);
+	return t.errors != 0;
+}
+
+/*
+ * Resume a run from its checkpoint, if any. Return the step number.
+ * The checkpoint shall be of the machine (and tape) files hashed
+ * into `digest`.
+ */
+uint64_t resume(TMExecutable* exec, uint64_t digest, char *path){
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return 0;
+	uint64_t i, h;
+	if (fread(&i, sizeof(i), 1, file) != 1 || fread(&h, sizeof(h), 1, file) != 1){
+		fprintf(stderr, "Checkpoint %s is corrupted.\n", path);
+		exit(1);
+	}
+	if (h != digest){
+		fprintf(stderr, "Checkpoint %s is of another machine.\n", path);
+		exit(1);
+	}
+	if (!TMTape_load(exec->tape, file, exec->machine->q)){
+		fprintf(stderr, "Checkpoint %s is corrupted.\n", path);
+		exit(1);
+	}
+	fclose(file);
+	return i;
+}
+
+/*
+ * Save a checkpoint of the run, replacing the previous one at once.
+ */
+void checkpoint(TMTape* tape, uint64_t i, uint64_t digest, char *path){
+	char *tmp = NEWARR(char, strlen(path) + 5);
+	assert(tmp);
+	sprintf(tmp, "%s.tmp", path);
+	FILE* file = fopen(tmp, "wb");
+	if (!file || fwrite(&i, sizeof(i), 1, file) != 1 || fwrite(&digest, sizeof(digest), 1, file) != 1
+		|| !TMTape_save(tape, file)
+		|| fflush(file) || fsync(fileno(file)) || fclose(file) || rename(tmp, path)){
+		fprintf(stderr, "Could not write %s.\n", path);
+		exit(1);
+	}
+	free(tmp);
+}
+
 int main(int argc, char **argv){
 	setlocale(LC_ALL, "");
 
 	struct arguments args = { 0 };
 	args.speed = 7;
+	args.backward_memory = TM_BACKWARD_MEMORY;
+	args.tape_memory = TM_TAPE_MEMORY;
 	// TODO: enable frame by default?
+	args.shards = 1;
+	args.interval = TM_ENUM_INTERVAL;
 	argp_parse(&parser, argc, argv, 0, 0, &args);
+	if (!args.threads)
+		args.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (args.merge)
+		return merge(args.merge);
+	if (args.states){
+		if (!args.steps)
+			args.steps = TM_ENUM_STEPS;
+		return enumerate(&args);
+	}
+	if (args.batch)
+		return batch(&args);
 	if (!args.in){
 		fprintf(stderr, "No filename specified.\n");
 		argp_help(&parser, stderr, ARGP_HELP_STD_ERR, "tm");
 		return 1;
 	}
+	if (args.loops && (args.native || args.jit || args.macro || args.rle)){
+		fprintf(stderr, "--detect-loops runs the machine itself, it cannot be "
+						"combined with --native, --jit, --macro or --rle.\n");
+		return 1;
+	}
+	if (args.checkpoint && args.loops){
+		fprintf(stderr, "Checkpoints are disabled with --detect-loops.\n");
+		args.checkpoint = NULL;
+	}
+	// These modes run whole, as --fast does.
+	char *mode = args.native ? "--native" : args.jit ? "--jit" : args.macro ? "--macro"
+			   : args.rle ? "--rle" : args.loops ? "--detect-loops"
+			   : args.checkpoint ? "--checkpoint" : NULL;
+	if (mode && !args.fast){
+		fprintf(stderr, "%s implies --fast.\n", mode);
+		args.fast = true;
+	}
+	if (args.native && args.tape_file){
+		fprintf(stderr, "Native machines keep the tape in memory.\n");
+		args.tape_file = NULL;
+	}
 	if (args.fast && args.tui){
 		fprintf(stderr, "TUI is disabled in fast mode.\n");
 		args.tui = false;
@@ -217,61 +886,160 @@ int main(int argc, char **argv){
 		TUI_init(set_speed, args.speed, paused, block);
 
 	uint64_t i = 0; // Step number.
-	TMProgram* program = TMProgram_parse(args.in);
-	if (args.tape)
-		TMProgram_parse_tape(program, args.tape);
-	TMExecutable* exec = TMProgram_compile(program, args.fast);
-	TMProgram_free(program);
-
-	global_set_frame(args.frame);
-	global_set_draw_all(false);
-
-	for (; exec->tape->state && !exec->machine->ok[exec->tape->state - 1]; i++){
-		if (args.fast){
-			// We do not want that much output while fast mode is enabled.
-			if (i % 10000000 == 0)
-				printf("Step:   %14lu\n", i);
-		} else {
-			if (args.tui)
-				TUI_render(exec->tape, exec->states, exec->chars, i);
+	TMExecutable* exec = TMC_open(args.in, args.tape, args.fast, !args.no_cache);
+	if (!exec)
+		return 1;
+
+	if (args.compile){
+		if (TMC_save(exec, args.compile))
+			return 0;
+		fprintf(stderr, "Could not write %s.\n", args.compile);
+		return 1;
+	}
+
+	if (args.emit_c || args.build)
+		return emit(exec, args.emit_c, args.build);
+
+	if (args.bouncer || args.backward)
+		return decide(exec, &args);
+
+	if (args.tapes)
+		return tapes(exec, &args);
+
+	TMNativeRun native = NULL;
+	if (args.native){
+		native = TMNative_load(args.native, exec);
+		if (!native)
+			return 1;
+	}
+
+	TMJit* jit = NULL;
+	if (args.jit){
+		jit = TMJit_compile(exec->machine, exec->tape->bits);
+		if (!jit)
+			fprintf(stderr, "Could not compile the machine, interpreting.\n");
+	}
+
+	TMMacro* macro = NULL;
+	if (args.macro)
+		macro = TMMacro_init(exec->machine, exec->tape->bits, args.macro);
+
+	TMRle* rle = NULL;
+	if (args.rle)
+		rle = TMRle_init(exec->machine);
+
+	// Checkpoints are of the machine and tape files they were taken with.
+	uint64_t digest = 0xcbf29ce484222325ull;
+	if (args.checkpoint && !TMC_digest(args.in, args.tape, &digest)){
+		fprintf(stderr, "Could not read %s.\n", args.in);
+		return 1;
+	}
+	if (args.checkpoint)
+		i = resume(exec, digest, args.checkpoint);
+	if (args.tape_file && !TMTape_map(exec->tape, args.tape_file, args.tape_memory)){
+		fprintf(stderr, "Could not create %s.\n", args.tape_file);
+		return 1;
+	}
+	time_t next = time(NULL) + args.interval;
+
+	TMLoop* loops = NULL;
+	if (args.loops)
+		loops = TMLoop_init(exec->machine, exec->tape);
+
+	TMThreaded* threaded = NULL;
+	if (args.fast && !native && !jit && !macro && !rle && !loops)
+		threaded = TMThreaded_init(exec->machine, exec->tape->bits);
+
+	if (args.fast){
+		// Whole runs are delegated to an engine, 10000000 steps at a time.
+		while (exec->tape->state && !exec->machine->ok[exec->tape->state - 1]
+			   && !(loops && loops->found)){
+			printf("Step:   %14lu\n", i);
+			uint64_t done;
+			if (native)
+				done = native(exec->tape, 10000000);
+			else if (jit)
+				done = TMJit_run(jit, exec->tape, 10000000);
+			else if (macro)
+				done = TMMacro_run(macro, exec->tape, 10000000);
+			else if (rle)
+				done = TMRle_run(rle, exec->tape, 10000000);
+			else if (loops)
+				done = TMLoop_run(loops, exec->tape, 10000000);
 			else
-				TMTape_print(exec->tape, exec->states, exec->chars, i, *block);
-
-			nanosleep(wait, NULL);
-			// A bit smarter tracked block transition.
-			// It is assumed that 3*TM_RENDER_BLOCK_SIZE cells are drawn.
-			if (exec->tape->pos - *block * TM_RENDER_BLOCK_SIZE >= TM_RENDER_BLOCK_SIZE * 3 / 2)
-				(*block)++;
-			else if (exec->tape->pos - *block * TM_RENDER_BLOCK_SIZE < -TM_RENDER_BLOCK_SIZE / 2)
-				(*block)--;
-
-			while (*paused){
-				nanosleep(&tick, NULL);
-				// Only TUI could have triggered a pause.
-				TUI_render(exec->tape, exec->states, exec->chars, i);
+				done = TMThreaded_run(threaded, exec->tape, 10000000);
+			i += done;
+			// A running machine shall do steps, or the engine is not its own.
+			if (!done && exec->tape->state && !exec->machine->ok[exec->tape->state - 1]
+				&& !(loops && loops->found)){
+				fprintf(stderr, "The machine made no progress in state %s.\n",
+						TMDict_at(exec->states, exec->tape->state));
+				return 1;
 			}
+			TMTape_release(exec->tape);
+			if (args.checkpoint && time(NULL) >= next){
+				checkpoint(exec->tape, i, digest, args.checkpoint);
+				next = time(NULL) + args.interval;
+			}
+		}
+		if (args.checkpoint)
+			checkpoint(exec->tape, i, digest, args.checkpoint);
+	}
+
+	for (; !args.fast && exec->tape->state && !exec->machine->ok[exec->tape->state - 1]; i++){
+		if (args.tui)
+			TUI_render(exec->tape, exec->states, exec->chars, i);
+		else
+			TMTape_print(exec->tape, exec->states, exec->chars, i, *block, args.frame, false);
+
+		nanosleep(wait, NULL);
+		// A bit smarter tracked block transition.
+		// It is assumed that 3*TM_RENDER_BLOCK_SIZE cells are drawn.
+		if (exec->tape->pos - *block * TM_RENDER_BLOCK_SIZE >= TM_RENDER_BLOCK_SIZE * 3 / 2)
+			(*block)++;
+		else if (exec->tape->pos - *block * TM_RENDER_BLOCK_SIZE < -TM_RENDER_BLOCK_SIZE / 2)
+			(*block)--;
+
+		while (*paused){
+			nanosleep(&tick, NULL);
+			// Only TUI could have triggered a pause.
+			TUI_render(exec->tape, exec->states, exec->chars, i);
 		}
 		TM_step(exec->machine, exec->tape);
 	}
 
-	global_set_draw_all(true);
-	
 	if (args.tui){
 		TUI_render(exec->tape, exec->states, exec->chars, i);
 		TUI_deinit();
 	} else {
 		if (!args.ultrafast)
-			TMTape_print(exec->tape, exec->states, exec->chars, i, *block);
+			TMTape_print(exec->tape, exec->states, exec->chars, i, *block, args.frame, true);
 	}
 	// 0 if state is defined, 1 otherwise.
 	int code = !exec->tape->state;
 
+	// 2 if the machine has been proven to loop.
+	if (loops && loops->found){
+		printf("Loop:   %14s\n", loops->found == TM_LOOP_EXACT ? "exact" : "translated");
+		printf("Period: %14lu\n", loops->period);
+		printf("Prefix: %14lu\n", loops->preperiod);
+		if (loops->found == TM_LOOP_TRANSLATED)
+			printf("Shift:  %14ld\n", loops->shift);
+		code = 2;
+	}
+
 	// Free the memory.
-	TM_free(exec->machine);
-	TMTape_free(exec->tape);
-	TMDict_free(exec->states);
-	TMDict_free(exec->chars);
-	free(exec);
+	if (jit)
+		TMJit_free(jit);
+	if (threaded)
+		TMThreaded_free(threaded);
+	if (macro)
+		TMMacro_free(macro);
+	if (rle)
+		TMRle_free(rle);
+	if (loops)
+		TMLoop_free(loops);
+	TMExecutable_free(exec);
 
 	munmap(wait, sizeof(struct timespec));
 	munmap(paused, sizeof(bool));
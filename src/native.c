@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "native.h"
+#include "util.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/wait.h>
+
+/*
+ * Tape structures as laid out in core.h.
+ * The emitted source checks the layout against the host one.
+ */
+static char tape_types[] =
+	"typedef struct {\n"
+	"\tint64_t start;\n"
+	"\tuint64_t n;\n"
+	"\tuint64_t *data;\n"
+	"\tint64_t end;\n"
+	"} TMTapePattern;\n"
+	"\n"
+	"typedef struct {\n"
+	"\tvoid *mem, *cells;\n"
+	"\tuint8_t bits;\n"
+	"\tint64_t lcap, rcap;\n"
+	"\tint64_t bl, br;\n"
+	"\tint64_t pos;\n"
+	"\tuint64_t state;\n"
+	"\tbool fast;\n"
+	"\tTMTapePattern left, right;\n"
+	"\tTMTapePattern *ranges;\n"
+	"\tuint64_t nr;\n"
+	"\tuint8_t *counts;\n"
+	"\tuint64_t live;\n"
+	"\tvoid *file;\n"
+	"} TMTape;\n";
+
+/*
+ * Tape memory management, same as in core.c
+ * (except for edge block trimming: native runs are fast).
+ */
+static char tape_code[] =
+	"static uint64_t undefined(TMTape* tape, int64_t pos){\n"
+	"\tif (tape->nr && pos >= tape->ranges[0].start && pos <= tape->ranges[tape->nr - 1].end){\n"
+	"\t\tuint64_t lo = 0, hi = tape->nr - 1;\n"
+	"\t\twhile (lo < hi){\n"
+	"\t\t\tuint64_t mid = (lo + hi + 1) / 2;\n"
+	"\t\t\tif (tape->ranges[mid].start <= pos)\n"
+	"\t\t\t\tlo = mid;\n"
+	"\t\t\telse\n"
+	"\t\t\t\thi = mid - 1;\n"
+	"\t\t}\n"
+	"\t\tif (pos <= tape->ranges[lo].end)\n"
+	"\t\t\treturn tape->ranges[lo].data[(pos - tape->ranges[lo].start) % tape->ranges[lo].n];\n"
+	"\t}\n"
+	"\tif (tape->left.n && pos < tape->left.start)\n"
+	"\t\treturn tape->left.data[(((pos - tape->left.start) % (int64_t)tape->left.n)\n"
+	"\t\t\t+ (int64_t)tape->left.n) % (int64_t)tape->left.n];\n"
+	"\tif (tape->right.n && pos >= tape->right.start)\n"
+	"\t\treturn tape->right.data[(((pos - tape->right.start) % (int64_t)tape->right.n)\n"
+	"\t\t\t+ (int64_t)tape->right.n) % (int64_t)tape->right.n];\n"
+	"\treturn 0;\n"
+	"}\n"
+	"\n"
+	"static void grow(TMTape* tape, bool right){\n"
+	"\tint64_t lcap = tape->lcap, rcap = tape->rcap;\n"
+	"\tif (right)\n"
+	"\t\trcap = rcap ? 2 * rcap : TM_TAPE_CAPACITY;\n"
+	"\telse\n"
+	"\t\tlcap = lcap ? 2 * lcap : TM_TAPE_CAPACITY;\n"
+	"\tif (!tape->mem){\n"
+	"\t\tlcap = lcap ? lcap : TM_TAPE_CAPACITY;\n"
+	"\t\trcap = rcap ? rcap : TM_TAPE_CAPACITY;\n"
+	"\t}\n"
+	"\tvoid *mem = NULL;\n"
+	"\tif (posix_memalign(&mem, TM_TAPE_ALIGN, (lcap + rcap) * BITS / 8))\n"
+	"\t\tabort();\n"
+	"\tif (tape->mem)\n"
+	"\t\tmemcpy((uint8_t*)mem + (lcap - tape->bl * TM_BLOCK_SIZE) * BITS / 8,\n"
+	"\t\t\t   (uint8_t*)tape->cells - tape->bl * TM_BLOCK_SIZE * BITS / 8,\n"
+	"\t\t\t   (tape->bl + tape->br) * TM_BLOCK_SIZE * BITS / 8);\n"
+	"\tfree(tape->mem);\n"
+	"\ttape->mem = mem;\n"
+	"\ttape->cells = (uint8_t*)mem + lcap * BITS / 8;\n"
+	"\ttape->lcap = lcap;\n"
+	"\ttape->rcap = rcap;\n"
+	"}\n"
+	"\n"
+	"static void alloc(TMTape* tape, bool right){\n"
+	"\tif (right){\n"
+	"\t\tif ((tape->br + 1) * TM_BLOCK_SIZE > tape->rcap)\n"
+	"\t\t\tgrow(tape, true);\n"
+	"\t\tfor (int64_t i = tape->br * TM_BLOCK_SIZE; i < (tape->br + 1) * TM_BLOCK_SIZE; i++)\n"
+	"\t\t\tSET(i, undefined(tape, i));\n"
+	"\t\ttape->br++;\n"
+	"\t} else {\n"
+	"\t\tif ((tape->bl + 1) * TM_BLOCK_SIZE > tape->lcap)\n"
+	"\t\t\tgrow(tape, false);\n"
+	"\t\tfor (int64_t i = -(tape->bl + 1) * TM_BLOCK_SIZE; i < -tape->bl * TM_BLOCK_SIZE; i++)\n"
+	"\t\t\tSET(i, undefined(tape, i));\n"
+	"\t\ttape->bl++;\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"#define RIGHT() do { if (pos == tape->br * TM_BLOCK_SIZE - 1) alloc(tape, true); pos++; } while (0)\n"
+	"#define LEFT() do { if (-pos == tape->bl * TM_BLOCK_SIZE) alloc(tape, false); pos--; } while (0)\n";
+
+/*
+ * Standalone driver, mimics the fast mode of main.c
+ * and TMTape_print (with TMTape_span).
+ */
+static char main_code[] =
+	"static uint64_t read_at(TMTape* tape, int64_t pos){\n"
+	"\tif (pos < -tape->bl * TM_BLOCK_SIZE || pos >= tape->br * TM_BLOCK_SIZE)\n"
+	"\t\treturn undefined(tape, pos);\n"
+	"\treturn GET(pos);\n"
+	"}\n"
+	"\n"
+	"static bool span(TMTape* tape, int64_t *left, int64_t *right){\n"
+	"\tint64_t lo = -tape->bl * TM_BLOCK_SIZE, end = tape->br * TM_BLOCK_SIZE,\n"
+	"\t\tl = INT64_MAX, r = INT64_MIN;\n"
+	"\tfor (int64_t p = lo; p < end && l == INT64_MAX; p++)\n"
+	"\t\tif (GET(p))\n"
+	"\t\t\tl = p;\n"
+	"\tfor (int64_t p = end - 1; p >= lo && r == INT64_MIN; p--)\n"
+	"\t\tif (GET(p))\n"
+	"\t\t\tr = p;\n"
+	"\tfor (uint64_t i = 0; i < tape->nr; i++){\n"
+	"\t\tTMTapePattern* range = &tape->ranges[i];\n"
+	"\t\tint64_t parts[2][2] = {\n"
+	"\t\t\t{ range->start, range->end < lo - 1 ? range->end : lo - 1 },\n"
+	"\t\t\t{ range->start > end ? range->start : end, range->end }\n"
+	"\t\t};\n"
+	"\t\tfor (int p = 0; p < 2; p++){\n"
+	"\t\t\tint64_t a = parts[p][0], b = parts[p][1];\n"
+	"\t\t\tfor (uint64_t k = 0; k < range->n && a + (int64_t)k <= b; k++)\n"
+	"\t\t\t\tif (range->data[(a + k - range->start) % range->n]){\n"
+	"\t\t\t\t\tl = a + (int64_t)k < l ? a + (int64_t)k : l;\n"
+	"\t\t\t\t\tbreak;\n"
+	"\t\t\t\t}\n"
+	"\t\t\tfor (uint64_t k = 0; k < range->n && b - (int64_t)k >= a; k++)\n"
+	"\t\t\t\tif (range->data[(b - k - range->start) % range->n]){\n"
+	"\t\t\t\t\tr = b - (int64_t)k > r ? b - (int64_t)k : r;\n"
+	"\t\t\t\t\tbreak;\n"
+	"\t\t\t\t}\n"
+	"\t\t}\n"
+	"\t}\n"
+	"\tif (l > r)\n"
+	"\t\treturn false;\n"
+	"\t*left = l;\n"
+	"\t*right = r;\n"
+	"\treturn true;\n"
+	"}\n"
+	"\n"
+	"int main(int argc, char **argv){\n"
+	"\tbool quiet = argc > 1 && strcmp(argv[1], \"-q\") == 0;\n"
+	"\tTMTape t = { 0 }, *tape = &t;\n"
+	"\tt.bits = BITS;\n"
+	"\tt.state = 1;\n"
+	"\tt.fast = true;\n"
+	"\tt.left = (TMTapePattern){ LEFT_START, sizeof(left_data) / sizeof(uint64_t) - 1, left_data };\n"
+	"\tt.right = (TMTapePattern){ RIGHT_START, sizeof(right_data) / sizeof(uint64_t) - 1, right_data };\n"
+	"\tt.ranges = ranges;\n"
+	"\tt.nr = sizeof(ranges) / sizeof(TMTapePattern) - 1;\n"
+	"\tfor (int64_t i = 0; i < INITIAL_BL; i++)\n"
+	"\t\talloc(tape, false);\n"
+	"\tfor (int64_t i = 0; i < INITIAL_BR; i++)\n"
+	"\t\talloc(tape, true);\n"
+	"\tfor (int64_t i = 0; i < (INITIAL_BL + INITIAL_BR) * TM_BLOCK_SIZE; i++)\n"
+	"\t\tSET(i - INITIAL_BL * TM_BLOCK_SIZE, initial[i]);\n"
+	"\tuint64_t i = 0;\n"
+	"\twhile (t.state && !final[t.state]){\n"
+	"\t\tprintf(\"Step:   %14lu\\n\", i);\n"
+	"\t\ti += run(tape, 10000000);\n"
+	"\t}\n"
+	"\tif (!quiet){\n"
+	"\t\tint64_t offset = 0, right = -1;\n"
+	"\t\tspan(tape, &offset, &right);\n"
+	"\t\tuint64_t len = right - offset + 1;\n"
+	"\t\tprintf(\"Step:   %14lu\\n\", i);\n"
+	"\t\tprintf(\"State:  %14s\\n\", states[t.state]);\n"
+	"\t\tprintf(\"Pos:    %14ld\\n\", t.pos);\n"
+	"\t\tprintf(\"Offset: %14ld\\n\", offset);\n"
+	"\t\tprintf(\"BL:     %14lu\\n\", t.bl);\n"
+	"\t\tprintf(\"BR:     %14lu\\n\", t.br);\n"
+	"\t\tfor (uint64_t i = 0; i < len; i++){\n"
+	"\t\t\tconst char *str = chars[read_at(tape, offset + (int64_t)i)];\n"
+	"\t\t\tprintf(\"%s \", str ? str : \"_\");\n"
+	"\t\t}\n"
+	"\t\tprintf(\"\\n\");\n"
+	"\t}\n"
+	"\tfree(t.mem);\n"
+	"\treturn !t.state;\n"
+	"}\n";
+
+void emit_pattern(FILE* out, char *name, TMTapePattern* pattern){
+	// A trailing zero keeps the array non-empty.
+	fprintf(out, "static uint64_t %s[] = { ", name);
+	for (uint64_t i = 0; i < pattern->n; i++)
+		fprintf(out, "%lu, ", pattern->data[i]);
+	fprintf(out, "0 };\n");
+}
+
+/*
+ * Write a name as a C string literal: tokens of machine
+ * files may contain quotes, backslashes and control characters.
+ */
+void emit_string(FILE* out, char *str){
+	fputc('"', out);
+	for (unsigned char *c = (unsigned char*)str; *c; c++)
+		if (*c == '"' || *c == '\\')
+			fprintf(out, "\\%c", *c);
+		else if (*c < 0x20 || *c == 0x7f)
+			fprintf(out, "\\%03o", *c);
+		else
+			fputc(*c, out);
+	fputc('"', out);
+}
+
+void emit_names(FILE* out, char *name, TMDict* dict, uint64_t n){
+	fprintf(out, "static const char *%s[] = {\n", name);
+	for (uint64_t i = 0; i < n; i++){
+		char *str = TMDict_at(dict, i);
+		if (str){
+			fprintf(out, "\t");
+			emit_string(out, str);
+			fprintf(out, ",\n");
+		} else
+			fprintf(out, "\tNULL,\n");
+	}
+	fprintf(out, "};\n");
+}
+
+/*
+ * Alphabet size, count of states, cell width and hash of the
+ * packed transitions of a machine, which `run` is only valid for.
+ */
+void TMNative_fingerprint(TMExecutable* exec, uint64_t print[4]){
+	TM* machine = exec->machine;
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (uint64_t s = 1; s < machine->q; s++)
+		for (uint64_t a = 0; a < machine->n; a++){
+			h = (h ^ TM_entry(machine, s, a)) * 0x9e3779b97f4a7c15ull;
+			h ^= h >> 32;
+		}
+	print[0] = machine->n;
+	print[1] = machine->q;
+	print[2] = exec->tape->bits;
+	print[3] = h;
+}
+
+/*
+ * Write a self-contained C source specialised for the machine.
+ */
+void TMExecutable_emit_c(TMExecutable* exec, FILE* out){
+	TM* machine = exec->machine;
+	TMTape* tape = exec->tape;
+
+	fprintf(out, "/*\n"
+				 " * Generated by tm: %lu states, %lu symbols.\n"
+				 " * Build with -DTM_SHARED to get a shared object exposing `run`.\n"
+				 " */\n\n", machine->q - 1, machine->n - 1);
+	fprintf(out, "#include <stdio.h>\n"
+				 "#include <stdlib.h>\n"
+				 "#include <stdint.h>\n"
+				 "#include <stdbool.h>\n"
+				 "#include <stddef.h>\n"
+				 "#include <string.h>\n\n");
+	fprintf(out, "#define TM_BLOCK_SIZE %d\n"
+				 "#define TM_TAPE_CAPACITY %d\n"
+				 "#define TM_TAPE_ALIGN %d\n"
+				 "#define BITS %d\n\n",
+				 TM_BLOCK_SIZE, TM_TAPE_CAPACITY, TM_TAPE_ALIGN, tape->bits);
+	fprintf(out, "%s\n", tape_types);
+	fprintf(out, "_Static_assert(sizeof(TMTape) == %zu, \"TMTape layout mismatch\");\n"
+				 "_Static_assert(offsetof(TMTape, bits) == %zu, \"TMTape layout mismatch\");\n"
+				 "_Static_assert(offsetof(TMTape, bl) == %zu, \"TMTape layout mismatch\");\n"
+				 "_Static_assert(offsetof(TMTape, state) == %zu, \"TMTape layout mismatch\");\n"
+				 "_Static_assert(offsetof(TMTape, right) == %zu, \"TMTape layout mismatch\");\n"
+				 "_Static_assert(offsetof(TMTape, ranges) == %zu, \"TMTape layout mismatch\");\n\n",
+				 sizeof(TMTape), offsetof(TMTape, bits), offsetof(TMTape, bl),
+				 offsetof(TMTape, state), offsetof(TMTape, right), offsetof(TMTape, ranges));
+	if (tape->bits == 1)
+		fprintf(out, "#define GET(p) ((((uint64_t*)tape->cells)[(p) >> 6] >> ((p) & 63)) & 1)\n"
+					 "#define SET(p, sym) (((uint64_t*)tape->cells)[(p) >> 6] = \\\n"
+					 "\t(((uint64_t*)tape->cells)[(p) >> 6] & ~(1ull << ((p) & 63))) \\\n"
+					 "\t| ((uint64_t)(sym) << ((p) & 63)))\n\n");
+	else
+		fprintf(out, "#define GET(p) (((uint%d_t*)tape->cells)[p])\n"
+					 "#define SET(p, sym) (((uint%d_t*)tape->cells)[p] = (sym))\n\n",
+					 tape->bits, tape->bits);
+	fprintf(out, "%s\n", tape_code);
+
+	// One label per state, one case per transition.
+	fprintf(out, "uint64_t run(TMTape* tape, uint64_t max_steps){\n"
+				 "\tint64_t pos = tape->pos;\n"
+				 "\tuint64_t steps = 0;\n"
+				 "\tif (tape->bits != BITS)\n"
+				 "\t\tabort();\n"
+				 "\tswitch (tape->state){\n");
+	for (uint64_t s = 1; s < machine->q; s++)
+		if (!machine->ok[s - 1])
+			fprintf(out, "\t\tcase %lu: goto S%lu;\n", s, s);
+	fprintf(out, "\t\tdefault: return 0;\n"
+				 "\t}\n");
+	for (uint64_t s = 1; s < machine->q; s++){
+		if (machine->ok[s - 1])
+			continue;
+		fprintf(out, "S%lu: // ", s);
+		emit_string(out, TMDict_at(exec->states, s));
+		fprintf(out, "\n"
+					 "\tif (steps == max_steps){\n"
+					 "\t\ttape->state = %lu;\n"
+					 "\t\tgoto out;\n"
+					 "\t}\n"
+					 "\tsteps++;\n"
+					 "\tswitch (GET(pos)){\n", s);
+		for (uint64_t a = 0; a < machine->n; a++){
+			uint64_t e = TM_entry(machine, s, a),
+					 s_to = TM_entry_state(machine, e),
+					 a_to = TM_entry_symbol(machine, e);
+			fprintf(out, "\t\tcase %lu: ", a);
+			if (a_to != a)
+				fprintf(out, "SET(pos, %lu); ", a_to);
+			fprintf(out, "%s(); ", TM_entry_motion(e) ? "RIGHT" : "LEFT");
+			if (e & TM_GO)
+				fprintf(out, "goto S%lu;\n", s_to);
+			else
+				fprintf(out, "tape->state = %lu; goto out;\n", s_to);
+		}
+		fprintf(out, "\t\tdefault: abort();\n"
+					 "\t}\n");
+	}
+	fprintf(out, "out:\n"
+				 "\ttape->pos = pos;\n"
+				 "\treturn steps;\n"
+				 "}\n\n");
+
+	uint64_t print[4];
+	TMNative_fingerprint(exec, print);
+	fprintf(out, "// Alphabet size, states, cell width and hash of the transitions.\n"
+				 "const uint64_t fingerprint[4] = { %luull, %luull, %luull, %luull };\n\n",
+				 print[0], print[1], print[2], print[3]);
+
+	// Initial tape, names and the driver.
+	fprintf(out, "#ifndef TM_SHARED\n\n");
+	fprintf(out, "#define LEFT_START %ldll\n"
+				 "#define RIGHT_START %ldll\n"
+				 "#define INITIAL_BL %ldll\n"
+				 "#define INITIAL_BR %ldll\n\n",
+				 tape->left.start, tape->right.start, tape->bl, tape->br);
+	emit_pattern(out, "left_data", &tape->left);
+	emit_pattern(out, "right_data", &tape->right);
+	for (uint64_t i = 0; i < tape->nr; i++){
+		char name[32];
+		sprintf(name, "range%lu_data", i);
+		emit_pattern(out, name, &tape->ranges[i]);
+	}
+	// A trailing empty pattern keeps the array non-empty.
+	fprintf(out, "static TMTapePattern ranges[] = {\n");
+	for (uint64_t i = 0; i < tape->nr; i++)
+		fprintf(out, "\t{ %ldll, %lu, range%lu_data, %ldll },\n",
+				tape->ranges[i].start, tape->ranges[i].n, i, tape->ranges[i].end);
+	fprintf(out, "\t{ 0 }\n};\n");
+	fprintf(out, "static const uint64_t initial[] = {");
+	for (int64_t i = -tape->bl * TM_BLOCK_SIZE; i < tape->br * TM_BLOCK_SIZE; i++)
+		fprintf(out, "%s%lu,", (i + tape->bl * TM_BLOCK_SIZE) % 16 ? " " : "\n\t",
+				TMTape_read_at(tape, i));
+	fprintf(out, "\n};\n");
+	fprintf(out, "static const bool final[] = { false,");
+	for (uint64_t s = 1; s < machine->q; s++)
+		fprintf(out, " %s,", machine->ok[s - 1] ? "true" : "false");
+	fprintf(out, " };\n");
+	emit_names(out, "states", exec->states, machine->q);
+	emit_names(out, "chars", exec->chars, machine->n);
+	fprintf(out, "\n%s\n", main_code);
+	fprintf(out, "#endif\n");
+}
+
+/*
+ * Compile an emitted source with the local `gcc`.
+ */
+bool TMNative_build(char *source, char *out, bool shared){
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0){
+		if (shared)
+			execlp("gcc", "gcc", "-O2", "-shared", "-fPIC", "-DTM_SHARED",
+				   "-o", out, source, (char*)NULL);
+		else
+			execlp("gcc", "gcc", "-O2", "-o", out, source, (char*)NULL);
+		_exit(127);
+	}
+	int status;
+	if (waitpid(pid, &status, 0) < 0)
+		return false;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Load `run` from a shared object built for the machine.
+ */
+TMNativeRun TMNative_load(char *path, TMExecutable* exec){
+	// Names without a slash would be looked up as libraries.
+	char *file = NEWARR(char, strlen(path) + 3);
+	assert(file);
+	sprintf(file, "%s%s", strchr(path, '/') ? "" : "./", path);
+	void *lib = dlopen(file, RTLD_NOW);
+	free(file);
+	if (!lib){
+		fprintf(stderr, "%s\n", dlerror());
+		return NULL;
+	}
+	TMNativeRun run = (TMNativeRun)dlsym(lib, "run");
+	uint64_t *print = dlsym(lib, "fingerprint"), own[4];
+	if (!run || !print){
+		fprintf(stderr, "%s\n", dlerror());
+		dlclose(lib);
+		return NULL;
+	}
+	TMNative_fingerprint(exec, own);
+	if (memcmp(print, own, sizeof(own))){
+		fprintf(stderr, "%s is built for another machine.\n", path);
+		dlclose(lib);
+		return NULL;
+	}
+	return run;
+}
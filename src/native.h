@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include "interpreter.h"
+
+/*
+ * Entry point of a natively compiled machine.
+ * Runs at most `max_steps` steps, returns the count
+ * of steps done.
+ */
+typedef uint64_t (*TMNativeRun)(TMTape*, uint64_t max_steps);
+
+/*
+ * Write a self-contained C source specialised for the
+ * machine: every state is a label and every transition
+ * is a hard-coded write, move and goto.
+ *
+ * The source exposes `run` (see TMNativeRun) operating on
+ * tapes of the same cell width and, unless TM_SHARED is
+ * defined, a `main` which runs the machine on the initial
+ * tape and prints the result just as `tm --fast` does
+ * (`-q` suppresses the final tape, as `-ff` does).
+ */
+void TMExecutable_emit_c(TMExecutable*, FILE*);
+
+/*
+ * Compile an emitted source with the local `gcc` into
+ * a standalone program or (if `shared`) into a shared object.
+ * Returns false on failure.
+ */
+bool TMNative_build(char *source, char *out, bool shared);
+
+/*
+ * Alphabet size, count of states, cell width and hash of the
+ * transitions of a machine. Emitted sources expose them as
+ * `fingerprint`.
+ */
+void TMNative_fingerprint(TMExecutable*, uint64_t print[4]);
+
+/*
+ * Load `run` from a shared object, which shall have been built
+ * for the machine (and cell width) of `exec`.
+ * Returns NULL (with a message) on failure.
+ */
+TMNativeRun TMNative_load(char *path, TMExecutable* exec);
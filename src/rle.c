@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "rle.h"
+#include "util.h"
+#include <stdlib.h>
+
+#define RUN(i) (rle->runs[i])
+
+TMRle* TMRle_init(TM* machine){
+	TMRle* rle = NEWSTR(TMRle);
+	assert(rle);
+	rle->machine = machine;
+	rle->size = TM_RLE_CAPACITY;
+	rle->runs = NEWARR(TMRun, rle->size);
+	assert(rle->runs);
+	rle->used = 1;
+	rle->free = 0;
+	rle->first = rle->last = 0;
+	return rle;
+}
+
+void TMRle_free(TMRle* rle){
+	free(rle->runs);
+	free(rle);
+}
+
+/*
+ * Take an unlinked run from the pool.
+ */
+uint64_t TMRle_new(TMRle* rle, uint64_t sym, uint64_t len){
+	uint64_t i = rle->free;
+	if (i)
+		rle->free = RUN(i).next;
+	else {
+		if (rle->used == rle->size){
+			rle->size *= 2;
+			rle->runs = realloc(rle->runs, rle->size * sizeof(TMRun));
+			assert(rle->runs);
+		}
+		i = rle->used++;
+	}
+	RUN(i) = (TMRun){ sym, len, 0, 0 };
+	return i;
+}
+
+/*
+ * Link run `i` right after (or, unless `after`, right before) run `at`.
+ * `at` may be 0 to link `i` at the right (left) end.
+ */
+void TMRle_link(TMRle* rle, uint64_t i, uint64_t at, bool after){
+	uint64_t prev = after ? (at ? at : rle->last) : (at ? RUN(at).prev : 0),
+			 next = after ? (at ? RUN(at).next : 0) : (at ? at : rle->first);
+	RUN(i).prev = prev;
+	RUN(i).next = next;
+	if (prev)
+		RUN(prev).next = i;
+	else
+		rle->first = i;
+	if (next)
+		RUN(next).prev = i;
+	else
+		rle->last = i;
+}
+
+void TMRle_unlink(TMRle* rle, uint64_t i){
+	if (RUN(i).prev)
+		RUN(RUN(i).prev).next = RUN(i).next;
+	else
+		rle->first = RUN(i).next;
+	if (RUN(i).next)
+		RUN(RUN(i).next).prev = RUN(i).prev;
+	else
+		rle->last = RUN(i).prev;
+	RUN(i).next = rle->free;
+	rle->free = i;
+}
+
+/*
+ * Append a cell to the right end (or, unless `right`, to the left end).
+ * Runs are only merged if `merge` is set.
+ */
+void TMRle_push(TMRle* rle, uint64_t sym, bool right, bool merge){
+	uint64_t end = right ? rle->last : rle->first;
+	if (merge && end && RUN(end).sym == sym)
+		RUN(end).len++;
+	else
+		TMRle_link(rle, TMRle_new(rle, sym, 1), 0, right);
+}
+
+/*
+ * Take a new tape block into use and append its cells
+ * to the right (left) end, without merging into the end run.
+ */
+void TMRle_extend(TMRle* rle, TMTape* tape, bool right){
+	TMTape_alloc(tape, right);
+	if (right)
+		for (int64_t i = 0; i < TM_BLOCK_SIZE; i++)
+			TMRle_push(rle, TMTape_get(tape, (tape->br - 1) * TM_BLOCK_SIZE + i), true, i > 0);
+	else
+		for (int64_t i = 1; i <= TM_BLOCK_SIZE; i++)
+			TMRle_push(rle, TMTape_get(tape, -(tape->bl - 1) * TM_BLOCK_SIZE - i), false, i > 1);
+}
+
+/*
+ * Write `sym` to cells [`from`..`from`+`k`-1] of run `i`, merging
+ * the result with equal neighbours. Returns the run now holding
+ * these cells and stores the offset of `from` in it.
+ */
+uint64_t TMRle_recolor(TMRle* rle, uint64_t i, uint64_t from, uint64_t k,
+					   uint64_t sym, uint64_t *offset){
+	*offset = from;
+	if (RUN(i).sym == sym)
+		return i;
+	uint64_t len = RUN(i).len, old = RUN(i).sym;
+	if (from + k < len)
+		TMRle_link(rle, TMRle_new(rle, old, len - from - k), i, true);
+	if (from > 0)
+		TMRle_link(rle, TMRle_new(rle, old, from), i, false);
+	RUN(i).sym = sym;
+	RUN(i).len = k;
+	*offset = 0;
+
+	uint64_t prev = RUN(i).prev, next = RUN(i).next;
+	if (prev && RUN(prev).sym == sym){
+		*offset = RUN(prev).len;
+		RUN(prev).len += k;
+		TMRle_unlink(rle, i);
+		i = prev;
+	}
+	if (next && RUN(next).sym == sym){
+		RUN(i).len += RUN(next).len;
+		TMRle_unlink(rle, next);
+	}
+	return i;
+}
+
+/*
+ * Run at most `max` steps on a fast tape.
+ */
+uint64_t TMRle_run(TMRle* rle, TMTape* tape, uint64_t max){
+	assert(tape->fast);
+	TM* machine = rle->machine;
+	uint64_t done = 0;
+	if (!max || !tape->state || machine->ok[tape->state - 1])
+		return 0;
+
+	// Encode the blocks in use and find the head.
+	rle->used = 1;
+	rle->free = 0;
+	rle->first = rle->last = 0;
+	int64_t lo = -tape->bl * TM_BLOCK_SIZE, hi = tape->br * TM_BLOCK_SIZE;
+	for (int64_t i = lo; i < hi; i++)
+		TMRle_push(rle, TMTape_get(tape, i), true, true);
+	int64_t pos = tape->pos;
+	uint64_t r = rle->first, o = pos - lo;
+	while (o >= RUN(r).len){
+		o -= RUN(r).len;
+		r = RUN(r).next;
+	}
+
+	uint64_t state = tape->state;
+	while (done < max && state && !machine->ok[state - 1]){
+		uint64_t e = TM_entry(machine, state, RUN(r).sym),
+				 s_to = TM_entry_state(machine, e),
+				 k = 1;
+		bool right = TM_entry_motion(e);
+
+		// S x -> S y repeats over the rest of the run.
+		if ((e & TM_GO) && s_to == state){
+			k = right ? RUN(r).len - o : o + 1;
+			if (k > max - done)
+				k = max - done;
+		}
+		uint64_t from = right ? o : o - (k - 1);
+		r = TMRle_recolor(rle, r, from, k, TM_entry_symbol(machine, e), &o);
+		if (right){
+			o += k - 1;
+			pos += k - 1;
+			if (++o == RUN(r).len){
+				if (!RUN(r).next)
+					TMRle_extend(rle, tape, true);
+				r = RUN(r).next;
+				o = 0;
+			}
+			pos++;
+		} else {
+			pos -= k - 1;
+			if (o == 0){
+				if (!RUN(r).prev)
+					TMRle_extend(rle, tape, false);
+				r = RUN(r).prev;
+				o = RUN(r).len;
+			}
+			o--;
+			pos--;
+		}
+		state = s_to;
+		done += k;
+	}
+
+	// Decode back into the flat tape.
+	int64_t cell = -tape->bl * TM_BLOCK_SIZE;
+	for (uint64_t i = rle->first; i; i = RUN(i).next)
+		for (uint64_t j = 0; j < RUN(i).len; j++)
+			TMTape_set(tape, cell++, RUN(i).sym);
+	tape->pos = pos;
+	tape->state = state;
+	return done;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "core.h"
+
+/*
+ * Initial count of runs in the pool.
+ */
+#define TM_RLE_CAPACITY 1024
+
+/*
+ * A run of `len` equal symbols, linked to its neighbours
+ * (0 is no neighbour).
+ */
+typedef struct {
+	uint64_t sym, len;
+	uint64_t prev, next;
+} TMRun;
+
+/*
+ * Run-length encoded view of the blocks in use of a tape.
+ * A state S reading a run of x with S x -> S y in either
+ * direction rewrites the rest of the run at once.
+ */
+typedef struct {
+	TM *machine;
+	TMRun *runs;          // pool, runs[0] is unused
+	uint64_t size,        // runs in the pool
+			 used,        // runs taken from the pool (free ones included)
+			 free;        // list of free runs (through `next`)
+	uint64_t first, last; // leftmost and rightmost runs
+} TMRle;
+
+TMRle* TMRle_init(TM*);
+void TMRle_free(TMRle*);
+
+/*
+ * Run at most `max` steps on a fast tape (exactly `max`,
+ * unless the machine halts). Return the count of steps done.
+ */
+uint64_t TMRle_run(TMRle*, TMTape*, uint64_t max);
@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#include "tmc.h"
+#include "util.h"
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint64_t align(uint64_t off, uint64_t to){
+	return (off + to - 1) & ~(to - 1);
+}
+
+/*
+ * Write `n` bytes at offset `off` of the file, padding it with zeros.
+ */
+static bool TMC_put(FILE* file, uint64_t off, void *data, size_t n){
+	for (long at = ftell(file); at < (long)off; at++)
+		if (fputc(0, file) == EOF)
+			return false;
+	return !n || fwrite(data, 1, n, file) == n;
+}
+
+/*
+ * Write the name offsets of a dictionary, the names starting at `off`.
+ * Return the offset past the names.
+ */
+static uint64_t TMC_put_offsets(FILE* file, TMDict* dict, uint64_t off, bool *ok){
+	for (uint64_t i = 1; i <= dict->n; i++){
+		char *name = TMDict_at(dict, i);
+		uint64_t at = name ? off : 0;
+		*ok = *ok && fwrite(&at, sizeof(at), 1, file) == 1;
+		if (name)
+			off += strlen(name) + 1;
+	}
+	return off;
+}
+
+/*
+ * Write the finite patterns of a tape: their bounds, then their symbols.
+ */
+static bool TMC_put_ranges(FILE* file, TMTape* tape){
+	for (uint64_t i = 0; i < tape->nr; i++){
+		int64_t bounds[3] = { tape->ranges[i].start, tape->ranges[i].end, tape->ranges[i].n };
+		if (fwrite(bounds, sizeof(bounds), 1, file) != 1)
+			return false;
+	}
+	for (uint64_t i = 0; i < tape->nr; i++)
+		if (fwrite(tape->ranges[i].data, sizeof(uint64_t), tape->ranges[i].n, file) != tape->ranges[i].n)
+			return false;
+	return true;
+}
+
+static bool TMC_put_names(FILE* file, TMDict* dict){
+	for (uint64_t i = 1; i <= dict->n; i++){
+		char *name = TMDict_at(dict, i);
+		if (name && fwrite(name, 1, strlen(name) + 1, file) != strlen(name) + 1)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Write a compiled machine to a file, replacing it at once.
+ */
+bool TMC_save(TMExecutable* exec, char *path){
+	TM* m = exec->machine;
+	TMTape* tape = exec->tape;
+	TMCHeader h = { 0 };
+	memcpy(h.magic, TM_TMC_MAGIC, 4);
+	h.version = TM_TMC_VERSION;
+	h.n = m->n;
+	h.q = m->q;
+	h.abits = m->abits;
+	h.width = m->width;
+	h.bits = tape->bits;
+	h.bl = tape->bl;
+	h.br = tape->br;
+	h.pos = tape->pos;
+	h.state = tape->state;
+	h.lstart = tape->left.start;
+	h.ln = tape->left.n;
+	h.rstart = tape->right.start;
+	h.rn = tape->right.n;
+	h.nr = tape->nr;
+	h.ns = exec->states->n;
+	h.nc = exec->chars->n;
+
+	uint64_t tsize = m->n * m->q * m->width,
+			 csize = (tape->bl + tape->br) * TM_BLOCK_SIZE * tape->bits / 8;
+	h.t = align(sizeof(h), 64);
+	h.ok = h.t + tsize;
+	h.cells = align(h.ok + m->q, 8);
+	h.left = align(h.cells + csize, 8);
+	h.right = h.left + h.ln * sizeof(uint64_t);
+	h.ranges = h.right + h.rn * sizeof(uint64_t);
+	h.names = h.ranges + h.nr * 3 * sizeof(int64_t);
+	for (uint64_t i = 0; i < tape->nr; i++)
+		h.names += tape->ranges[i].n * sizeof(uint64_t);
+	uint64_t strings = h.names + (h.ns + h.nc) * sizeof(uint64_t);
+
+	// Other processes (or threads) may be writing the same file.
+	char *tmp = NEWARR(char, strlen(path) + 8);
+	assert(tmp);
+	sprintf(tmp, "%s.XXXXXX", path);
+	int fd = mkstemp(tmp);
+	FILE* file = fd < 0 ? NULL : fdopen(fd, "wb");
+	if (!file){
+		if (fd >= 0){
+			close(fd);
+			unlink(tmp);
+		}
+		free(tmp);
+		return false;
+	}
+	fchmod(fd, 0644);
+	uint8_t *cells = (uint8_t*)tape->cells - tape->bl * TM_BLOCK_SIZE * tape->bits / 8;
+	bool ok = fwrite(&h, sizeof(h), 1, file) == 1
+		&& TMC_put(file, h.t, m->t, tsize)
+		&& TMC_put(file, h.ok, m->ok, m->q)
+		&& TMC_put(file, h.cells, cells, csize)
+		&& TMC_put(file, h.left, tape->left.data, h.ln * sizeof(uint64_t))
+		&& TMC_put(file, h.right, tape->right.data, h.rn * sizeof(uint64_t))
+		&& TMC_put_ranges(file, tape);
+	uint64_t off = TMC_put_offsets(file, exec->states, strings, &ok);
+	h.size = TMC_put_offsets(file, exec->chars, off, &ok);
+	ok = ok && TMC_put_names(file, exec->states) && TMC_put_names(file, exec->chars)
+		&& fseek(file, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, file) == 1;
+	ok = !fclose(file) && ok && !rename(tmp, path);
+	if (!ok)
+		unlink(tmp);
+	free(tmp);
+	return ok;
+}
+
+/*
+ * Whether a file is a compiled machine file.
+ */
+bool TMC_check(char *path){
+	// Pipes are not looked into, they cannot be read twice.
+	char magic[4];
+	struct stat st;
+	if (stat(path, &st) || !S_ISREG(st.st_mode))
+		return false;
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+	bool ok = fread(magic, 4, 1, file) == 1 && memcmp(magic, TM_TMC_MAGIC, 4) == 0;
+	fclose(file);
+	return ok;
+}
+
+/*
+ * Whether the sections of a header fit in a file of the given size.
+ */
+static bool TMC_valid(TMCHeader* h, uint64_t size){
+	if (size < sizeof(*h) || memcmp(h->magic, TM_TMC_MAGIC, 4) || h->version != TM_TMC_VERSION
+		|| h->size != size || (h->width != 4 && h->width != 8) || !h->q || !h->n
+		|| (h->bits != 1 && h->bits != 8 && h->bits != 16 && h->bits != 32 && h->bits != 64)
+		|| h->bl < 0 || h->br < 1 || h->pos < -h->bl * TM_BLOCK_SIZE
+		|| h->pos >= h->br * TM_BLOCK_SIZE)
+		return false;
+	uint64_t csize = (h->bl + h->br) * TM_BLOCK_SIZE * h->bits / 8;
+	return h->t + h->n * h->q * h->width <= h->ok && h->ok + h->q <= h->cells
+		&& h->cells + csize <= h->left && h->left + h->ln * sizeof(uint64_t) <= h->right
+		&& h->right + h->rn * sizeof(uint64_t) <= h->ranges
+		&& h->ranges + h->nr * 3 * sizeof(int64_t) <= h->names
+		&& h->names + (h->ns + h->nc) * sizeof(uint64_t) <= size;
+}
+
+/*
+ * Whether the finite patterns are in order and fit in their section.
+ */
+static bool TMC_valid_ranges(uint8_t *map, TMCHeader* h){
+	int64_t *bounds = (int64_t*)(map + h->ranges);
+	uint64_t off = h->ranges + h->nr * 3 * sizeof(int64_t);
+	for (uint64_t i = 0; i < h->nr; i++, bounds += 3){
+		uint64_t n = bounds[2];
+		if (!n || n > (h->names - off) / sizeof(uint64_t) || bounds[0] > bounds[1]
+			|| (i && bounds[0] <= bounds[-2]))
+			return false;
+		off += n * sizeof(uint64_t);
+	}
+	return true;
+}
+
+/*
+ * Whether symbols of `count` cells of `bits` bits are below `n`.
+ */
+static bool TMC_valid_cells(uint8_t *cells, uint64_t count, uint8_t bits, uint64_t n){
+	if (bits == 1 || (bits < 64 && n >= 1ull << bits))
+		return true;
+	for (uint64_t i = 0; i < count; i++){
+		uint64_t sym;
+		switch (bits){
+			case 8: sym = cells[i]; break;
+			case 16: sym = ((uint16_t*)cells)[i]; break;
+			case 32: sym = ((uint32_t*)cells)[i]; break;
+			default: sym = ((uint64_t*)cells)[i];
+		}
+		if (sym >= n)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Whether the machine of a mapping is in range: final states are
+ * booleans, transitions go to states below q (`go` being set as
+ * TM_pack sets it) and write symbols below n, and so do the state
+ * and the symbols of the tape. A stale or corrupt file is refused
+ * rather than run.
+ */
+static bool TMC_valid_machine(uint8_t *map, TMCHeader* h){
+	if (!h->abits || h->abits > 64 - TM_SHIFT - 1 || h->n > 1ull << h->abits
+		|| h->bits != TMTape_bits(h->n) || h->state >= h->q)
+		return false;
+	bool *ok = (bool*)(map + h->ok);
+	for (uint64_t s = 0; s < h->q; s++)
+		if (map[h->ok + s] > 1)
+			return false;
+	TM machine = { h->n, h->q, ok, h->abits, h->width, map + h->t, true };
+	for (uint64_t s = 1; s < h->q; s++)
+		for (uint64_t a = 0; a < h->n; a++){
+			uint64_t e = TM_entry(&machine, s, a), to = TM_entry_state(&machine, e);
+			if (to >= h->q || TM_entry_symbol(&machine, e) >= h->n
+				|| (e & TM_GO) != (to && !ok[to - 1] ? TM_GO : 0))
+				return false;
+		}
+	if (!TMC_valid_cells(map + h->cells, (h->bl + h->br) * TM_BLOCK_SIZE, h->bits, h->n)
+		|| !TMC_valid_cells(map + h->left, h->ln, 64, h->n)
+		|| !TMC_valid_cells(map + h->right, h->rn, 64, h->n))
+		return false;
+	int64_t *bounds = (int64_t*)(map + h->ranges);
+	uint64_t off = h->ranges + h->nr * 3 * sizeof(int64_t);
+	for (uint64_t i = 0; i < h->nr; i++, bounds += 3){
+		if (!TMC_valid_cells(map + off, bounds[2], 64, h->n))
+			return false;
+		off += bounds[2] * sizeof(uint64_t);
+	}
+	return true;
+}
+
+/*
+ * Point the tokens of a dictionary into the mapping.
+ */
+static TMDict* TMC_dict(uint8_t *map, uint64_t size, uint64_t *offsets, uint64_t n){
+	TMDict* dict = TMDict_init();
+	dict->n = dict->cap = n;
+	dict->tok = NEWARR(char*, n);
+	assert(dict->tok || !n);
+	for (uint64_t i = 0; i < n; i++)
+		dict->tok[i] = offsets[i] && offsets[i] < size ? (char*)map + offsets[i] : NULL;
+	return dict;
+}
+
+static TMTapePattern TMC_pattern(uint8_t *map, uint64_t off, int64_t start, uint64_t n){
+	TMTapePattern pattern = { start, n, NULL, 0 };
+	if (n){
+		pattern.data = NEWARR(uint64_t, n);
+		assert(pattern.data);
+		memcpy(pattern.data, map + off, n * sizeof(uint64_t));
+	}
+	return pattern;
+}
+
+/*
+ * Map a compiled machine file. Returns NULL on failure.
+ */
+static TMExecutable* TMC_map(char *path, bool fast){
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st)){
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	uint8_t *map = st.st_size ? mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+							  : MAP_FAILED;
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	TMCHeader* h = (TMCHeader*)map;
+	// The last name shall be terminated.
+	if (!TMC_valid(h, st.st_size) || !TMC_valid_ranges(map, h) || !TMC_valid_machine(map, h)
+		|| (h->ns + h->nc && map[st.st_size - 1] != '\0')){
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	TM* machine = NEWSTR(TM);
+	assert(machine);
+	machine->n = h->n;
+	machine->q = h->q;
+	machine->abits = h->abits;
+	machine->width = h->width;
+	machine->ok = zalloc2(h->q);
+	memcpy(machine->ok, map + h->ok, h->q);
+	machine->t = map + h->t;
+	machine->shared = true;
+
+	TMTape* tape = TMTape_init(h->bits, fast);
+	tape->left = TMC_pattern(map, h->left, h->lstart, h->ln);
+	tape->right = TMC_pattern(map, h->right, h->rstart, h->rn);
+	if (h->nr){
+		tape->ranges = NEWARR(TMTapePattern, h->nr);
+		assert(tape->ranges);
+		tape->nr = h->nr;
+		int64_t *bounds = (int64_t*)(map + h->ranges);
+		uint64_t off = h->ranges + h->nr * 3 * sizeof(int64_t);
+		for (uint64_t i = 0; i < h->nr; i++, bounds += 3){
+			tape->ranges[i] = TMC_pattern(map, off, bounds[0], bounds[2]);
+			tape->ranges[i].end = bounds[1];
+			off += bounds[2] * sizeof(uint64_t);
+		}
+	}
+	TMTape_prepare(tape);
+	while (tape->bl < h->bl)
+		TMTape_alloc(tape, false);
+	while (tape->br < h->br)
+		TMTape_alloc(tape, true);
+	memcpy((uint8_t*)tape->cells - tape->bl * TM_BLOCK_SIZE * tape->bits / 8, map + h->cells,
+		   (h->bl + h->br) * TM_BLOCK_SIZE * h->bits / 8);
+	TMTape_recount(tape);
+	tape->pos = h->pos;
+	tape->state = h->state;
+
+	TMExecutable* exec = NEWSTR(TMExecutable);
+	assert(exec);
+	exec->machine = machine;
+	exec->tape = tape;
+	uint64_t *names = (uint64_t*)(map + h->names);
+	exec->states = TMC_dict(map, st.st_size, names, h->ns);
+	exec->chars = TMC_dict(map, st.st_size, names + h->ns, h->nc);
+	exec->map = map;
+	exec->size = st.st_size;
+	return exec;
+}
+
+/*
+ * Map a compiled machine file.
+ */
+TMExecutable* TMC_load(char *path, bool fast){
+	TMExecutable* exec = TMC_map(path, fast);
+	if (!exec)
+		fprintf(stderr, "%s is not a compiled machine of this version.\n", path);
+	return exec;
+}
+
+/*
+ * Hash contents of a file into `h`. Return false if it cannot be read.
+ */
+static bool TMC_hash(char *path, uint64_t *h){
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)){
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	uint8_t *map = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	uint64_t size = st.st_size, i = 0;
+	for (; i + 8 <= size; i += 8){
+		uint64_t word;
+		memcpy(&word, map + i, 8);
+		*h = (*h ^ word) * 0x9e3779b97f4a7c15ull;
+		*h ^= *h >> 32;
+	}
+	for (; i < size; i++)
+		*h = (*h ^ map[i]) * 0x100000001b3ull;
+	*h = (*h ^ size) * 0x9e3779b97f4a7c15ull;
+	if (map)
+		munmap(map, size);
+	return true;
+}
+
+bool TMC_digest(char *path, char *tape, uint64_t *h){
+	return TMC_hash(path, h) && (!tape || TMC_hash(tape, h));
+}
+
+/*
+ * Path of the cache entry of a machine (and tape) file, creating
+ * the cache directory if needed. Returns NULL if there is none.
+ */
+static char* TMC_cache_path(char *path, char *tape){
+	uint64_t h = 0xcbf29ce484222325ull ^ TM_TMC_VERSION;
+	if (!TMC_digest(path, tape, &h))
+		return NULL;
+	char *dir = getenv("TM_CACHE_DIR"), *base = NULL;
+	if (!dir){
+		char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+		if (!xdg && !home)
+			return NULL;
+		base = NEWARR(char, strlen(xdg ? xdg : home) + 16);
+		assert(base);
+		sprintf(base, xdg ? "%s" : "%s/.cache", xdg ? xdg : home);
+		mkdir(base, 0755);
+		strcat(base, "/tm");
+		dir = base;
+	}
+	mkdir(dir, 0755);
+	char *entry = NEWARR(char, strlen(dir) + 22);
+	assert(entry);
+	sprintf(entry, "%s/%016lx.tmc", dir, h);
+	free(base);
+	return entry;
+}
+
+/*
+ * Load a machine, looking it up in the cache if `cache` is set.
+ */
+TMExecutable* TMC_open(char *path, char *tape, bool fast, bool cache){
+	if (TMC_check(path)){
+		TMExecutable* exec = TMC_load(path, fast);
+		if (!exec || !tape)
+			return exec;
+		// Only the tape is taken from the tape file.
+		TMProgram* program = NEWSTR(TMProgram);
+		assert(program);
+		*program = (TMProgram){ 0 };
+		TMTape* t = NULL;
+		if (TMProgram_parse_tape(program, tape))
+			t = TMProgram_tape(program, exec->chars, exec->tape->bits, fast);
+		TMProgram_free(program);
+		if (!t){
+			TMExecutable_free(exec);
+			return NULL;
+		}
+		TMTape_free(exec->tape);
+		exec->tape = t;
+		return exec;
+	}
+	char *entry = cache ? TMC_cache_path(path, tape) : NULL;
+	if (entry){
+		// A broken entry is replaced.
+		TMExecutable* exec = TMC_map(entry, fast);
+		if (exec){
+			free(entry);
+			return exec;
+		}
+	}
+	TMProgram* program = TMProgram_parse(path);
+	if (!program || (tape && !TMProgram_parse_tape(program, tape))){
+		if (program)
+			TMProgram_free(program);
+		free(entry);
+		return NULL;
+	}
+	TMExecutable* exec = TMProgram_compile(program, fast);
+	TMProgram_free(program);
+	// A cache which cannot be written is not an error.
+	if (entry)
+		TMC_save(exec, entry);
+	free(entry);
+	return exec;
+}
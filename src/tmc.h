@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2019 Daniil Fomichev <azathtoth@protonmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#pragma once
+
+#include "interpreter.h"
+
+#define TM_TMC_MAGIC "TMC\x1a"
+/*
+ * Version of the format, to be increased on any change of it
+ * (or of the packing of transitions).
+ */
+#define TM_TMC_VERSION 2
+
+/*
+ * A compiled machine file (.tmc) is a header followed by sections
+ * at the given offsets, in the byte order of the host:
+ *
+ *   t       packed transition table (as in TM, aligned to 64 bytes)
+ *   ok      final states (a byte per state)
+ *   cells   blocks in use of the tape (as in TMTape)
+ *   left    left infinite pattern (64-bit symbols)
+ *   right   right infinite pattern (64-bit symbols)
+ *   ranges  finite patterns: start, end and length of each
+ *           (64-bit integers), then their symbols
+ *   names   offsets of the names of the states, then of the symbols
+ *           (0 for none), followed by the null-terminated names
+ *
+ * The transition table and the names are used in place from
+ * a private mapping of the file, the tape is copied.
+ */
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint64_t n, q;                  // as in TM
+	uint8_t abits, width, bits, pad[5];
+	int64_t bl, br, pos;            // as in TMTape
+	uint64_t state;
+	int64_t lstart, rstart;         // starts of the patterns
+	uint64_t ln, rn;                // lengths of the patterns
+	uint64_t nr;                    // count of finite patterns
+	uint64_t ns, nc;                // counts of state and symbol names
+	uint64_t t, ok, cells, left, right, ranges, names; // section offsets
+	uint64_t size;                  // of the file
+} TMCHeader;
+
+/*
+ * Write a compiled machine to a file, replacing it at once.
+ * Return false if it cannot be written.
+ */
+bool TMC_save(TMExecutable*, char *path);
+
+/*
+ * Whether a file is a compiled machine file.
+ */
+bool TMC_check(char *path);
+
+/*
+ * Map a compiled machine file.
+ * Returns NULL (with a message) on failure.
+ */
+TMExecutable* TMC_load(char *path, bool fast);
+
+/*
+ * Hash contents of a machine file and of a tape file (if not NULL)
+ * into `h`, as the cache does. Return false if they cannot be read.
+ */
+bool TMC_digest(char *path, char *tape, uint64_t *h);
+
+/*
+ * Load a machine: a compiled machine file is mapped, a machine file
+ * (with the tape from `tape`, if not NULL) is parsed and compiled.
+ * With `cache` set, a compiled machine file is looked up in the cache
+ * directory (TM_CACHE_DIR, $XDG_CACHE_HOME/tm or ~/.cache/tm) under
+ * the hash of the files, and stored there if it is not found.
+ * Returns NULL (with a message) on failure.
+ */
+TMExecutable* TMC_open(char *path, char *tape, bool fast, bool cache);
@@ -12,6 +12,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <time.h>
@@ -21,12 +22,12 @@
 #define FRAME_COLOUR 1
 #define STATS_COLOUR 2
 
-void (*upd)(uint8_t);
-WINDOW *wtape, *wstats;
-uint64_t *tui_speed;
-bool *state, *paused, *reset, rendered;
-int64_t *block;
-struct timespec tick;
+static void (*upd)(uint8_t);
+static WINDOW *wtape, *wstats;
+static uint64_t *tui_speed;
+static bool *state, *paused, *reset, rendered;
+static int64_t *block;
+static struct timespec tick;
 
 void TMTape_printw(TMTape* tape, TMDict* chars, int64_t block);
 void TUI_process_keypresses();
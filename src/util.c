@@ -15,6 +15,10 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 bool* zalloc2(uint64_t n){
 	bool* mem = NEWARR(bool, n);
@@ -64,7 +68,7 @@ char* readline_trim(FILE* file){
 			only_spaces = false;
 		str[len] = c;
 		if (len == reserved){
-			reserved += 20;
+			reserved *= 2;
 			str = realloc(str, (reserved + 1) * sizeof(char));
 			assert(str);
 		}
@@ -80,6 +84,81 @@ char* readline_trim(FILE* file){
 	return str;
 }
 
+TMText* TMText_open(char *path){
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	TMText* text = NEWSTR(TMText);
+	assert(text);
+	text->data = NULL;
+	text->size = text->len = 0;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+		// The file is mapped over a zero-filled reservation one byte
+		// larger, so that the zero byte after it is always there.
+		long page = sysconf(_SC_PAGESIZE);
+		size_t len = (st.st_size + page) & ~(size_t)(page - 1);
+		char *mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem != MAP_FAILED){
+			if (mmap(mem, st.st_size, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED){
+				madvise(mem, st.st_size, MADV_SEQUENTIAL);
+				text->data = mem;
+				text->size = st.st_size;
+				text->len = len;
+			} else
+				munmap(mem, len);
+		}
+	}
+	if (!text->data){
+		// Pipes and the like are read as a whole.
+		size_t cap = 4096;
+		text->data = NEWARR(char, cap + 1);
+		assert(text->data);
+		ssize_t got;
+		while ((got = read(fd, text->data + text->size, cap - text->size)) > 0){
+			text->size += got;
+			if (text->size == cap){
+				cap *= 2;
+				text->data = realloc(text->data, cap + 1);
+				assert(text->data);
+			}
+		}
+		text->data[text->size] = '\0';
+	}
+	close(fd);
+	text->next = text->data;
+	return text;
+}
+
+void TMText_close(TMText* text){
+	if (text->len)
+		munmap(text->data, text->len);
+	else
+		free(text->data);
+	free(text);
+}
+
+char* TMText_line(TMText* text){
+	char *end = text->data + text->size;
+	if (text->next == end)
+		return NULL;
+	char *line = text->next,
+		 *eol = memchr(line, '\n', end - line);
+	if (!eol)
+		eol = end;
+	text->next = eol == end ? end : eol + 1;
+	while (line < eol && isspace(*line))
+		line++;
+	while (eol > line && isspace(eol[-1]))
+		eol--;
+	*eol = '\0';
+	if (eol - line >= 2 && line[0] == '/' && line[1] == '/')
+		line[0] = '\0';
+	return line;
+}
+
 static char allowed[] = "-_.~+-^<>[]{}()";
 
 bool check_name(char *name){
@@ -13,7 +13,10 @@
 
 #pragma once
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <stdbool.h>
 #include <assert.h>
 
@@ -34,6 +37,28 @@ int64_t modulo(int64_t a, int64_t n);
 // Read a line, ignoring comments and removing leading and ending spaces.
 char* readline_trim(FILE*);
 
+// A text file mapped privately into memory (or, if it cannot be
+// mapped, read into it), followed by a zero byte. Lines are cut
+// in place, so tokens may point into it for as long as it is open.
+typedef struct {
+	char *data;
+	size_t size;   // of the file
+	size_t len;    // of the mapping (0 if read)
+	char *next;    // start of the next line
+} TMText;
+
+// Returns NULL if the file cannot be opened.
+TMText* TMText_open(char *path);
+void TMText_close(TMText*);
+
+// Next line as readline_trim gives it, terminated in place.
+// Returns NULL at the end of the text.
+char* TMText_line(TMText*);
+
+static inline bool TMText_end(TMText* text){
+	return text->next == text->data + text->size;
+}
+
 // Checks whether a string contains only letters, digits and
 // some whitelisted special symbols.
 bool check_name(char *name);